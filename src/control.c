@@ -3,10 +3,24 @@
 #include <linux/printk.h>
 #include <linux/dma-mapping.h>
 #include <linux/usb.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/seq_file.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
 #include <sound/control.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
+#include <sound/tlv.h>
 #include "control.h"
+#include "pcm.h"
+#include "hwdep.h"
 
 // Global volume range variables (set once during initialization)
 static int16_t katana_vol_min = -20480;  // Default fallback
@@ -14,11 +28,119 @@ static int16_t katana_vol_max = 0;       // Default fallback
 static int16_t katana_vol_res = 1;       // Default fallback
 static int katana_vol_range_initialized = 0;
 
+// Volume/mute cache, filled in the background after probe so the first
+// mixer read doesn't wait on USB round trips. Entries go stale after
+// KATANA_CACHE_MS, since the speaker's own buttons move the hardware volume.
+#define KATANA_CACHE_MS 1000
+static DEFINE_MUTEX(katana_cache_mutex);
+static int16_t katana_vol_cached;
+static int katana_mute_cached;
+static unsigned long katana_vol_stamp;    // jiffies when katana_vol_cached was read
+static unsigned long katana_mute_stamp;
+static int katana_vol_valid = 0;
+static int katana_mute_valid = 0;
+
+// Background prefetch
+static struct usb_device *katana_prefetch_dev;
+static ktime_t katana_prefetch_start;
+static u64 katana_controls_ready_us;      // Probe start to prefetched controls
+static void katana_prefetch_work_fn(struct work_struct *work);
+void katana_control_cancel_prefetch(void);
+static DECLARE_WORK(katana_prefetch_work, katana_prefetch_work_fn);
+
+// Digital trim: -40dB..0dB in 0.5dB steps, applied while filling URBs
+#define KATANA_TRIM_STEPS 80
+#define KATANA_TRIM_STEP_Q30 1013677647 // 10^(-0.5/20) in Q2.30
+static int katana_trim_steps = KATANA_TRIM_STEPS; // 0dB, bit-exact
+static const DECLARE_TLV_DB_SCALE(katana_trim_tlv, -4000, 50, 0);
+
 // Removed auto-unmute logic - let ALSA handle mute/unmute properly
 
 // Forward declarations
 static int katana_set_hardware_mute(struct usb_device *usb_dev, int mute);
 
+// Control request latency accounting, per request type and control
+enum {
+	KATANA_REQ_GET_CUR,
+	KATANA_REQ_SET_CUR,
+	KATANA_REQ_GET_MIN,
+	KATANA_REQ_GET_MAX,
+	KATANA_REQ_GET_RES,
+	KATANA_REQ_COUNT,
+};
+
+enum {
+	KATANA_CTL_VOLUME,
+	KATANA_CTL_MUTE,
+	KATANA_CTL_TONE,
+	KATANA_CTL_COUNT,
+};
+
+#define KATANA_LAT_BUCKETS 20 // log2 buckets of microseconds, last one open ended
+
+static const char * const katana_req_names[KATANA_REQ_COUNT] = {
+	"GET_CUR", "SET_CUR", "GET_MIN", "GET_MAX", "GET_RES",
+};
+
+static const char * const katana_ctl_names[KATANA_CTL_COUNT] = {
+	"volume", "mute", "tone",
+};
+
+static struct katana_ctrl_stat {
+	u64 count;
+	u64 errors;
+	u64 total_us;
+	u32 max_us;
+	u32 hist[KATANA_LAT_BUCKETS];  // hist[b]: latency below 2^b us
+} katana_ctrl_stats[KATANA_CTL_COUNT][KATANA_REQ_COUNT];
+static DEFINE_SPINLOCK(katana_ctrl_stats_lock);
+
+// usb_control_msg() for feature unit requests, timed and accounted
+static int katana_ctrl_msg(struct usb_device *usb_dev, unsigned int pipe, u8 request,
+			   u8 requesttype, u16 value, u16 index, void *data, u16 size,
+			   int timeout)
+{
+	struct katana_ctrl_stat *stat;
+	unsigned long flags;
+	ktime_t start = ktime_get();
+	int req, ctl, bucket, err;
+	u32 us;
+	
+	err = usb_control_msg(usb_dev, pipe, request, requesttype, value, index,
+			      data, size, timeout);
+	us = ktime_us_delta(ktime_get(), start);
+	
+	switch (request) {
+	case 0x01: req = KATANA_REQ_SET_CUR; break;
+	case 0x81: req = KATANA_REQ_GET_CUR; break;
+	case 0x82: req = KATANA_REQ_GET_MIN; break;
+	case 0x83: req = KATANA_REQ_GET_MAX; break;
+	case 0x84: req = KATANA_REQ_GET_RES; break;
+	default: return err;
+	}
+	
+	switch (value >> 8) {
+	case 0x01: ctl = KATANA_CTL_MUTE; break;
+	case 0x02: ctl = KATANA_CTL_VOLUME; break;
+	default: ctl = KATANA_CTL_TONE; break;
+	}
+	
+	bucket = min(fls(us), KATANA_LAT_BUCKETS - 1);
+	stat = &katana_ctrl_stats[ctl][req];
+	
+	spin_lock_irqsave(&katana_ctrl_stats_lock, flags);
+	stat->count++;
+	if (err < 0)
+		stat->errors++;
+	stat->total_us += us;
+	if (us > stat->max_us)
+		stat->max_us = us;
+	stat->hist[bucket]++;
+	spin_unlock_irqrestore(&katana_ctrl_stats_lock, flags);
+	
+	return err;
+}
+
 // Get volume range from device using USB Audio Class standard requests
 static int katana_get_volume_range(struct usb_device *usb_dev, int16_t *min_vol, int16_t *max_vol, int16_t *res_vol)
 {
@@ -34,7 +156,7 @@ static int katana_get_volume_range(struct usb_device *usb_dev, int16_t *min_vol,
 	}
 	
 	// Get MIN value
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_rcvctrlpipe(usb_dev, 0),
 			      0x82,  // GET_MIN
 			      0xA1,  // bmRequestType
@@ -52,7 +174,7 @@ static int katana_get_volume_range(struct usb_device *usb_dev, int16_t *min_vol,
 	}
 	
 	// Get MAX value
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_rcvctrlpipe(usb_dev, 0),
 			      0x83,  // GET_MAX
 			      0xA1,  // bmRequestType
@@ -70,7 +192,7 @@ static int katana_get_volume_range(struct usb_device *usb_dev, int16_t *min_vol,
 	}
 	
 	// Get RES value
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_rcvctrlpipe(usb_dev, 0),
 			      0x84,  // GET_RES
 			      0xA1,  // bmRequestType
@@ -100,6 +222,18 @@ static int katana_get_volume_range(struct usb_device *usb_dev, int16_t *min_vol,
 	return 0;
 }
 
+// Read the volume range once. Serialized under katana_cache_mutex, so the
+// prefetch worker and the first mixer access don't query it side by side.
+static void katana_init_volume_range(struct usb_device *usb_dev)
+{
+	int16_t min_vol, max_vol, res_vol;
+	
+	mutex_lock(&katana_cache_mutex);
+	if (!katana_vol_range_initialized)
+		katana_get_volume_range(usb_dev, &min_vol, &max_vol, &res_vol);
+	mutex_unlock(&katana_cache_mutex);
+}
+
 // Set raw hardware volume value
 static int katana_set_hardware_volume_raw(struct usb_device *usb_dev, int16_t volume_value)
 {
@@ -107,12 +241,6 @@ static int katana_set_hardware_volume_raw(struct usb_device *usb_dev, int16_t vo
 	unsigned char *volume_data;
 	dma_addr_t dma_addr;
 	
-	// Initialize volume range if not done already
-	if (!katana_vol_range_initialized) {
-		int16_t min_vol, max_vol, res_vol;
-		katana_get_volume_range(usb_dev, &min_vol, &max_vol, &res_vol);
-	}
-	
 	// Allocate USB coherent memory for control transfer
 	volume_data = usb_alloc_coherent(usb_dev, 2, GFP_KERNEL, &dma_addr);
 	if (!volume_data) {
@@ -130,7 +258,7 @@ static int katana_set_hardware_volume_raw(struct usb_device *usb_dev, int16_t vo
 	// bRequest: 0x01 = SET_CUR
 	// wValue: (0x02 << 8) | 0x01 = Volume Control (0x02) on channel 1 (left)
 	// wIndex: 0x0100 = Interface 0, Feature Unit ID 1 (speaker output)
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_sndctrlpipe(usb_dev, 0),
 			      0x01,  // SET_CUR
 			      0x21,  // bmRequestType
@@ -147,7 +275,7 @@ static int katana_set_hardware_volume_raw(struct usb_device *usb_dev, int16_t vo
 	}
 	
 	// Also set right channel (channel 2)
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_sndctrlpipe(usb_dev, 0),
 			      0x01,  // SET_CUR
 			      0x21,  // bmRequestType
@@ -170,23 +298,18 @@ static int katana_set_hardware_volume_raw(struct usb_device *usb_dev, int16_t vo
 // Removed unused percentage-based volume control function
 
 // Get raw hardware volume value (not percentage)
-static int16_t katana_get_hardware_volume_raw(struct usb_device *usb_dev)
+// Returns 0 with *volume set, or a negative error
+static int katana_get_hardware_volume_raw(struct usb_device *usb_dev, int16_t *volume)
 {
 	int err;
 	unsigned char *volume_data;
 	dma_addr_t dma_addr;
 	
-	// Initialize volume range if not done already
-	if (!katana_vol_range_initialized) {
-		int16_t min_vol, max_vol, res_vol;
-		katana_get_volume_range(usb_dev, &min_vol, &max_vol, &res_vol);
-	}
-	
 	// Allocate USB coherent memory for control transfer
 	volume_data = usb_alloc_coherent(usb_dev, 2, GFP_KERNEL, &dma_addr);
 	if (!volume_data) {
 		pr_err("Katana Control: Failed to allocate coherent memory for volume control\n");
-		return katana_vol_min; // Return minimum on error
+		return -ENOMEM;
 	}
 	
 	// Send GET_CUR request for volume control
@@ -195,7 +318,7 @@ static int16_t katana_get_hardware_volume_raw(struct usb_device *usb_dev)
 	// bRequest: 0x81 = GET_CUR
 	// wValue: (0x02 << 8) | 0x01 = Volume Control (0x02) on channel 1 (left)
 	// wIndex: 0x0100 = Interface 0, Feature Unit ID 1 (speaker output)
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_rcvctrlpipe(usb_dev, 0),
 			      0x81,  // GET_CUR
 			      0xA1,  // bmRequestType
@@ -208,16 +331,16 @@ static int16_t katana_get_hardware_volume_raw(struct usb_device *usb_dev)
 	if (err < 0) {
 		pr_err("Katana Control: Failed to get hardware volume: %d\n", err);
 		usb_free_coherent(usb_dev, 2, volume_data, dma_addr);
-		return katana_vol_min; // Return minimum on error
+		return err;
 	}
 	
-	// Return raw 16-bit signed volume value
-	int16_t volume_value = volume_data[0] | (volume_data[1] << 8);
+	// Raw 16-bit signed volume value
+	*volume = volume_data[0] | (volume_data[1] << 8);
 	
 	pr_debug("Katana Control: Got raw hardware volume 0x%04x (%d)\n", 
-		(uint16_t)volume_value, volume_value);
+		(uint16_t)*volume, *volume);
 	usb_free_coherent(usb_dev, 2, volume_data, dma_addr);
-	return volume_value;
+	return 0;
 }
 
 // Get hardware volume using USB Audio Class control requests (returns percentage)
@@ -246,7 +369,7 @@ static int katana_set_hardware_mute(struct usb_device *usb_dev, int mute)
 	// bRequest: 0x01 = SET_CUR
 	// wValue: (0x01 << 8) | 0x00 = Mute Control (0x01) on channel 0 (master)
 	// wIndex: 0x0100 = Interface 0, Feature Unit ID 1 (speaker output)
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_sndctrlpipe(usb_dev, 0),
 			      0x01,  // SET_CUR
 			      0x21,  // bmRequestType
@@ -287,7 +410,7 @@ static int katana_get_hardware_mute(struct usb_device *usb_dev)
 	// bRequest: 0x81 = GET_CUR
 	// wValue: (0x01 << 8) | 0x00 = Mute Control (0x01) on channel 0 (master)
 	// wIndex: 0x0100 = Interface 0, Feature Unit ID 1 (speaker output)
-	err = usb_control_msg(usb_dev,
+	err = katana_ctrl_msg(usb_dev,
 			      usb_rcvctrlpipe(usb_dev, 0),
 			      0x81,  // GET_CUR
 			      0xA1,  // bmRequestType
@@ -329,8 +452,23 @@ int katana_volume_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucon
 		return 0;
 	}
 	
-	// Get raw volume from device
-	int16_t raw_volume = katana_get_hardware_volume_raw(usb_dev);
+	katana_init_volume_range(usb_dev);
+	
+	// Get raw volume from the cache, or the device if it's stale.
+	// A failed read keeps the last known value, or reports the minimum.
+	int16_t raw_volume;
+	mutex_lock(&katana_cache_mutex);
+	if (katana_vol_valid &&
+	    time_before(jiffies, katana_vol_stamp + msecs_to_jiffies(KATANA_CACHE_MS))) {
+		raw_volume = katana_vol_cached;
+	} else if (katana_get_hardware_volume_raw(usb_dev, &raw_volume) == 0) {
+		katana_vol_cached = raw_volume;
+		katana_vol_stamp = jiffies;
+		katana_vol_valid = 1;
+	} else {
+		raw_volume = katana_vol_valid ? katana_vol_cached : katana_vol_min;
+	}
+	mutex_unlock(&katana_cache_mutex);
 	if (raw_volume < katana_vol_min) {
 		ucontrol->value.integer.value[0] = 0; // Default on error
 		return 0;
@@ -352,10 +490,7 @@ int katana_volume_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucon
 	}
 	
 	// Initialize volume range if not done already
-	if (!katana_vol_range_initialized) {
-		int16_t min_vol, max_vol, res_vol;
-		katana_get_volume_range(usb_dev, &min_vol, &max_vol, &res_vol);
-	}
+	katana_init_volume_range(usb_dev);
 	
 	int alsa_steps = ucontrol->value.integer.value[0];
 	
@@ -367,6 +502,13 @@ int katana_volume_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucon
 	if (raw_volume > katana_vol_max) raw_volume = katana_vol_max;
 	
 	int err = katana_set_hardware_volume_raw(usb_dev, raw_volume);
+	if (err == 0) {
+		mutex_lock(&katana_cache_mutex);
+		katana_vol_cached = raw_volume;
+		katana_vol_stamp = jiffies;
+		katana_vol_valid = 1;
+		mutex_unlock(&katana_cache_mutex);
+	}
 	
 	return (err == 0) ? 1 : 0; // Return 1 if changed successfully
 }
@@ -385,10 +527,8 @@ int katana_volume_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinf
 	// Initialize volume range if not done already (get USB device from control)
 	if (!katana_vol_range_initialized) {
 		struct usb_device *usb_dev = get_usb_device_from_control(kctl);
-		if (usb_dev) {
-			int16_t min_vol, max_vol, res_vol;
-			katana_get_volume_range(usb_dev, &min_vol, &max_vol, &res_vol);
-		}
+		if (usb_dev)
+			katana_init_volume_range(usb_dev);
 	}
 	
 	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
@@ -412,7 +552,20 @@ int katana_mute_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontr
 		return 0;
 	}
 	
-	int mute = katana_get_hardware_mute(usb_dev);
+	int mute;
+	mutex_lock(&katana_cache_mutex);
+	if (katana_mute_valid &&
+	    time_before(jiffies, katana_mute_stamp + msecs_to_jiffies(KATANA_CACHE_MS))) {
+		mute = katana_mute_cached;
+	} else {
+		mute = katana_get_hardware_mute(usb_dev);
+		if (mute >= 0) {
+			katana_mute_cached = mute;
+			katana_mute_stamp = jiffies;
+			katana_mute_valid = 1;
+		}
+	}
+	mutex_unlock(&katana_cache_mutex);
 	if (mute < 0) {
 		mute = 1; // Default on error
 	}
@@ -432,6 +585,13 @@ int katana_mute_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontr
 	int new_mute = ucontrol->value.integer.value[0];
 	
 	int err = katana_set_hardware_mute(usb_dev, new_mute);
+	if (err == 0) {
+		mutex_lock(&katana_cache_mutex);
+		katana_mute_cached = !!new_mute;
+		katana_mute_stamp = jiffies;
+		katana_mute_valid = 1;
+		mutex_unlock(&katana_cache_mutex);
+	}
 	
 	return (err == 0) ? 1 : 0; // Return 1 if changed successfully
 }
@@ -465,4 +625,1130 @@ struct snd_kcontrol_new katana_mute_ctl = {
 	.get	       = katana_mute_get,
 	.put	       = katana_mute_put,
 	.info	       = katana_mute_info,
-};
\ No newline at end of file
+};
+
+// Digital trim callbacks
+// The hardware attenuator is coarse at low levels, so the trim fills in
+// finer steps below it. The gain is computed here once per change, so the
+// fill path only does one multiply per sample.
+int katana_trim_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	ucontrol->value.integer.value[0] = katana_trim_steps;
+	return 0;
+}
+
+static void katana_apply_trim(int steps)
+{
+	u64 gain = 1U << 30;
+	int i;
+	
+	// One 0.5dB step of attenuation per step below the top
+	for (i = steps; i < KATANA_TRIM_STEPS; i++)
+		gain = (gain * KATANA_TRIM_STEP_Q30) >> 30;
+	
+	katana_trim_steps = steps;
+	katana_pcm_set_trim_gain(gain);
+	pr_debug("Katana Control: Trim set - %d steps (gain 0x%08llx)\n", steps, gain);
+}
+
+int katana_trim_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	int steps = ucontrol->value.integer.value[0];
+	
+	if (steps < 0 || steps > KATANA_TRIM_STEPS)
+		return -EINVAL;
+	if (steps == katana_trim_steps)
+		return 0;
+	
+	katana_apply_trim(steps);
+	return 1;
+}
+
+int katana_trim_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = KATANA_TRIM_STEPS;
+
+	return 0;
+}
+
+struct snd_kcontrol_new katana_trim_ctl = {
+	.iface	       = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name	       = "Digital Playback Volume", // Software trim below the hardware volume
+	.index	       = 0,
+	.access	       = SNDRV_CTL_ELEM_ACCESS_READWRITE |
+			 SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+	.get	       = katana_trim_get,
+	.put	       = katana_trim_put,
+	.info	       = katana_trim_info,
+	.tlv.p	       = katana_trim_tlv,
+};
+
+// Level meters, computed by the PCM fill path over each period
+// Values are linear 24-bit magnitudes (0 to 8388607 = full scale). Change
+// events are rate limited so a meter client wakes at most 20 times per
+// second, however short the period is. A change inside the window is sent
+// when the window ends, so the last level before silence isn't lost.
+#define KATANA_METER_MAX 0x7fffff
+#define KATANA_METER_EVENT_MS 50
+
+// katana_meter_event_lock covers the control pointers and event state, and
+// is held while notifying, so no event is sent once removal has started.
+static DEFINE_SPINLOCK(katana_meter_event_lock);
+static struct snd_kcontrol *katana_meter_kctls[2]; // Peak, RMS
+static unsigned long katana_meter_event_stamp;
+static int katana_meter_event_pending;
+static int katana_meter_removing;
+static void katana_meter_event_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(katana_meter_event_work, katana_meter_event_fn);
+
+int katana_meter_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	u32 peak[2], rms[2];
+	u32 *val = kctl->private_value ? rms : peak;
+	
+	katana_pcm_get_meters(peak, rms);
+	ucontrol->value.integer.value[0] = val[0];
+	ucontrol->value.integer.value[1] = val[1];
+	return 0;
+}
+
+int katana_meter_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 2;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = KATANA_METER_MAX;
+
+	return 0;
+}
+
+struct snd_kcontrol_new katana_meter_ctl = {
+	.iface	       = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.index	       = 0,
+	.access	       = SNDRV_CTL_ELEM_ACCESS_READ |
+			 SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.get	       = katana_meter_get,
+	.info	       = katana_meter_info,
+};
+
+// Add the "PCM Peak Meter" and "PCM RMS Meter" controls
+int katana_meter_add_controls(struct snd_card *card)
+{
+	static const char * const names[] = { "PCM Peak Meter", "PCM RMS Meter" };
+	struct snd_kcontrol_new tmpl = katana_meter_ctl;
+	struct snd_kcontrol *kctl;
+	unsigned long flags;
+	int i, err;
+	
+	spin_lock_irqsave(&katana_meter_event_lock, flags);
+	katana_meter_removing = 0;
+	spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+	
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		tmpl.name = names[i];
+		tmpl.private_value = i;
+		kctl = snd_ctl_new1(&tmpl, card);
+		if (!kctl)
+			return -ENOMEM;
+		err = snd_ctl_add(card, kctl);
+		if (err < 0)
+			return err;
+		spin_lock_irqsave(&katana_meter_event_lock, flags);
+		katana_meter_kctls[i] = kctl;
+		spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+	}
+	return 0;
+}
+
+// Notify both meters (katana_meter_event_lock held)
+static void katana_meter_notify_locked(void)
+{
+	int i;
+	
+	katana_meter_event_pending = 0;
+	katana_meter_event_stamp = jiffies;
+	for (i = 0; i < ARRAY_SIZE(katana_meter_kctls); i++) {
+		struct snd_kcontrol *kctl = katana_meter_kctls[i];
+		
+		if (kctl)
+			snd_ctl_notify(kctl->private_data, SNDRV_CTL_EVENT_MASK_VALUE, &kctl->id);
+	}
+}
+
+// Send the event held back by the rate limit
+static void katana_meter_event_fn(struct work_struct *work)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&katana_meter_event_lock, flags);
+	if (katana_meter_event_pending && !katana_meter_removing)
+		katana_meter_notify_locked();
+	spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+}
+
+// Tell mixer clients the meters moved (atomic context, from the PCM)
+// Unless forced, at most one event per KATANA_METER_EVENT_MS is sent; a
+// change inside the window is postponed to its end.
+void katana_control_meter_changed(int force)
+{
+	unsigned long now = jiffies;
+	unsigned long flags;
+	unsigned long due;
+	
+	spin_lock_irqsave(&katana_meter_event_lock, flags);
+	if (katana_meter_removing || !katana_meter_kctls[0]) {
+		spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+		return;
+	}
+	due = katana_meter_event_stamp + msecs_to_jiffies(KATANA_METER_EVENT_MS);
+	if (!force && time_before(now, due)) {
+		if (!katana_meter_event_pending) {
+			katana_meter_event_pending = 1;
+			schedule_delayed_work(&katana_meter_event_work, due - now);
+		}
+	} else {
+		katana_meter_notify_locked();
+	}
+	spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+}
+
+// Stop meter events before the card and its controls go away (disconnect).
+// The stream may still be running; once removing is set under the lock,
+// nothing notifies or queues the work again.
+void katana_meter_remove_controls(void)
+{
+	unsigned long flags;
+	
+	spin_lock_irqsave(&katana_meter_event_lock, flags);
+	katana_meter_removing = 1;
+	katana_meter_event_pending = 0;
+	memset(katana_meter_kctls, 0, sizeof(katana_meter_kctls));
+	spin_unlock_irqrestore(&katana_meter_event_lock, flags);
+	
+	cancel_delayed_work_sync(&katana_meter_event_work);
+}
+
+// Onboard tone processing (UAC1 Feature Unit 1)
+// Creative's own DSP features (SBX, dialog enhancement) are driven through
+// undocumented vendor requests, so only the standard feature unit controls
+// the device advertises in bmaControls are exposed here. Their state is
+// cached, so .get never touches the bus and presets only send what changed.
+#define KATANA_FEATURE_UNIT_ID 1
+#define KATANA_FU_BASS 0x03
+#define KATANA_FU_MID 0x04
+#define KATANA_FU_TREBLE 0x05
+#define KATANA_FU_BASS_BOOST 0x09
+#define KATANA_FU_LOUDNESS 0x0a
+#define KATANA_FU_MAX 0x0b
+
+static u32 katana_fu_controls;                    // bmaControls of the master channel
+static s8 katana_fu_cache[KATANA_FU_MAX];          // Last value sent/read, per selector
+static int katana_fu_cached;                       // Cache filled from the device
+static struct snd_kcontrol *katana_fu_kctls[KATANA_FU_MAX]; // For change notifications
+static struct snd_kcontrol *katana_eq_preset_kctl;
+static DEFINE_MUTEX(katana_fu_mutex);
+
+// Tone values are 1/4dB steps; presets stay well inside the UAC1 range
+static const DECLARE_TLV_DB_SCALE(katana_tone_tlv, -3200, 25, 0);
+
+// Presets, in 1/4dB for bass/mid/treble plus bass boost and loudness
+static const char * const katana_eq_preset_names[] = {
+	"Flat", "Bass", "Voice", "Bright", "Night", "Custom",
+};
+#define KATANA_EQ_CUSTOM (ARRAY_SIZE(katana_eq_preset_names) - 1)
+
+static const s8 katana_eq_presets[][KATANA_FU_MAX] = {
+	{ 0 }, // Flat
+	{ [KATANA_FU_BASS] = 24, [KATANA_FU_BASS_BOOST] = 1 },
+	{ [KATANA_FU_BASS] = -8, [KATANA_FU_MID] = 16, [KATANA_FU_TREBLE] = 4 },
+	{ [KATANA_FU_TREBLE] = 20 },
+	{ [KATANA_FU_BASS] = -16, [KATANA_FU_LOUDNESS] = 1 },
+};
+
+static const u8 katana_fu_selectors[] = {
+	KATANA_FU_BASS, KATANA_FU_MID, KATANA_FU_TREBLE,
+	KATANA_FU_BASS_BOOST, KATANA_FU_LOUDNESS,
+};
+
+// Find Feature Unit 1 in the AudioControl descriptors and read its
+// master channel bmaControls
+static u32 katana_parse_feature_unit(struct usb_host_interface *alts)
+{
+	unsigned char *p = alts->extra;
+	int left = alts->extralen;
+	
+	for (; left >= 2 && p[0] >= 2 && p[0] <= left; left -= p[0], p += p[0]) {
+		u32 controls = 0;
+		int i;
+		
+		// CS_INTERFACE, FEATURE_UNIT
+		if (p[0] < 7 || p[1] != 0x24 || p[2] != 0x06 || p[3] != KATANA_FEATURE_UNIT_ID)
+			continue;
+		if (p[5] == 0 || 6 + p[5] > p[0])
+			continue;
+		
+		for (i = 0; i < p[5] && i < 4; i++)
+			controls |= p[6 + i] << (i * 8);
+		return controls;
+	}
+	
+	return 0;
+}
+
+// Single byte feature unit request on the master channel
+static int katana_fu_request(struct usb_device *usb_dev, int set, int selector, s8 *value)
+{
+	int err;
+	unsigned char *fu_data;
+	dma_addr_t dma_addr;
+	
+	// Allocate USB coherent memory for control transfer
+	fu_data = usb_alloc_coherent(usb_dev, 1, GFP_KERNEL, &dma_addr);
+	if (!fu_data) {
+		pr_err("Katana Control: Failed to allocate coherent memory for feature unit control\n");
+		return -ENOMEM;
+	}
+	
+	fu_data[0] = *value;
+	err = katana_ctrl_msg(usb_dev,
+			      set ? usb_sndctrlpipe(usb_dev, 0) : usb_rcvctrlpipe(usb_dev, 0),
+			      set ? 0x01 : 0x81,  // SET_CUR / GET_CUR
+			      set ? 0x21 : 0xA1,  // bmRequestType
+			      selector << 8,      // wValue: control selector, channel 0 (master)
+			      KATANA_FEATURE_UNIT_ID << 8, // wIndex: Interface 0, Feature Unit 1
+			      fu_data,
+			      1,
+			      1000);
+	if (err >= 0)
+		*value = fu_data[0];
+	else
+		pr_err("Katana Control: Feature unit %s 0x%02x failed: %d\n",
+		       set ? "SET_CUR" : "GET_CUR", selector, err);
+	
+	usb_free_coherent(usb_dev, 1, fu_data, dma_addr);
+	return err < 0 ? err : 0;
+}
+
+// Fill the cache from the device once (katana_fu_mutex held)
+static void katana_fu_fill_cache(struct usb_device *usb_dev)
+{
+	int i;
+	
+	if (katana_fu_cached)
+		return;
+	
+	for (i = 0; i < ARRAY_SIZE(katana_fu_selectors); i++) {
+		int sel = katana_fu_selectors[i];
+		s8 value = 0;
+		
+		if (!(katana_fu_controls & BIT(sel - 1)))
+			continue;
+		if (katana_fu_request(usb_dev, 0, sel, &value) == 0)
+			katana_fu_cache[sel] = value;
+	}
+	katana_fu_cached = 1;
+}
+
+// Send one value if it differs from the cache (katana_fu_mutex held)
+static int katana_fu_update(struct usb_device *usb_dev, int selector, s8 value)
+{
+	int err;
+	
+	if (katana_fu_cache[selector] == value)
+		return 0;
+	
+	err = katana_fu_request(usb_dev, 1, selector, &value);
+	if (err < 0)
+		return err;
+	
+	katana_fu_cache[selector] = value;
+	return 1;
+}
+
+// Preset matching the cached state, or Custom (katana_fu_mutex held)
+static unsigned int katana_eq_preset_match(void)
+{
+	unsigned int preset;
+	int i;
+	
+	for (preset = 0; preset < ARRAY_SIZE(katana_eq_presets); preset++) {
+		for (i = 0; i < ARRAY_SIZE(katana_fu_selectors); i++) {
+			int sel = katana_fu_selectors[i];
+			
+			if ((katana_fu_controls & BIT(sel - 1)) &&
+			    katana_fu_cache[sel] != katana_eq_presets[preset][sel])
+				break;
+		}
+		if (i == ARRAY_SIZE(katana_fu_selectors))
+			break;
+	}
+	
+	return preset;
+}
+
+// Tell listeners "EQ Preset" reads back differently after tone changes
+static void katana_eq_preset_changed(struct snd_card *card)
+{
+	if (katana_eq_preset_kctl)
+		snd_ctl_notify(card, SNDRV_CTL_EVENT_MASK_VALUE, &katana_eq_preset_kctl->id);
+}
+
+static int katana_fu_is_switch(int selector)
+{
+	return selector == KATANA_FU_BASS_BOOST || selector == KATANA_FU_LOUDNESS;
+}
+
+int katana_tone_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo)
+{
+	if (katana_fu_is_switch(kctl->private_value)) {
+		uinfo->type = SNDRV_CTL_ELEM_TYPE_BOOLEAN;
+		uinfo->value.integer.min = 0;
+		uinfo->value.integer.max = 1;
+	} else {
+		// Signed 1/4dB steps (-32dB..+31.75dB), offset so ALSA sees 0..255
+		uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+		uinfo->value.integer.min = 0;
+		uinfo->value.integer.max = 255;
+	}
+	uinfo->count = 1;
+	
+	return 0;
+}
+
+int katana_tone_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	struct usb_device *usb_dev = get_usb_device_from_control(kctl);
+	int sel = kctl->private_value;
+	s8 value;
+	
+	mutex_lock(&katana_fu_mutex);
+	if (usb_dev)
+		katana_fu_fill_cache(usb_dev);
+	value = katana_fu_cache[sel];
+	mutex_unlock(&katana_fu_mutex);
+	
+	ucontrol->value.integer.value[0] = katana_fu_is_switch(sel) ? !!value : value + 128;
+	return 0;
+}
+
+int katana_tone_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	struct usb_device *usb_dev = get_usb_device_from_control(kctl);
+	int sel = kctl->private_value;
+	long v = ucontrol->value.integer.value[0];
+	unsigned int preset;
+	int preset_changed;
+	int err;
+	
+	if (!usb_dev) {
+		return 0;
+	}
+	
+	if (katana_fu_is_switch(sel)) {
+		v = !!v;
+	} else {
+		if (v < 0 || v > 255)
+			return -EINVAL;
+		v -= 128;
+	}
+	
+	mutex_lock(&katana_fu_mutex);
+	katana_fu_fill_cache(usb_dev);
+	preset = katana_eq_preset_match();
+	err = katana_fu_update(usb_dev, sel, v);
+	preset_changed = err > 0 && katana_eq_preset_match() != preset;
+	mutex_unlock(&katana_fu_mutex);
+	
+	if (preset_changed)
+		katana_eq_preset_changed(kctl->private_data);
+	
+	return err;
+}
+
+int katana_eq_preset_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo)
+{
+	return snd_ctl_enum_info(uinfo, 1, ARRAY_SIZE(katana_eq_preset_names),
+				 katana_eq_preset_names);
+}
+
+// Report the preset matching the cached state, or Custom
+int katana_eq_preset_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	struct usb_device *usb_dev = get_usb_device_from_control(kctl);
+	unsigned int preset;
+	
+	mutex_lock(&katana_fu_mutex);
+	if (usb_dev)
+		katana_fu_fill_cache(usb_dev);
+	preset = katana_eq_preset_match();
+	mutex_unlock(&katana_fu_mutex);
+	
+	ucontrol->value.enumerated.item[0] = preset;
+	return 0;
+}
+
+// Apply a whole profile in one go: only controls that differ from the
+// cache are sent, back to back under the mutex, then listeners are told
+int katana_eq_preset_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol)
+{
+	struct usb_device *usb_dev = get_usb_device_from_control(kctl);
+	unsigned int preset = ucontrol->value.enumerated.item[0];
+	unsigned long changed = 0;
+	int i, err = 0;
+	
+	if (preset >= ARRAY_SIZE(katana_eq_preset_names))
+		return -EINVAL;
+	if (!usb_dev || preset == KATANA_EQ_CUSTOM)
+		return 0;
+	
+	mutex_lock(&katana_fu_mutex);
+	katana_fu_fill_cache(usb_dev);
+	for (i = 0; i < ARRAY_SIZE(katana_fu_selectors); i++) {
+		int sel = katana_fu_selectors[i];
+		
+		if (!(katana_fu_controls & BIT(sel - 1)))
+			continue;
+		err = katana_fu_update(usb_dev, sel, katana_eq_presets[preset][sel]);
+		if (err < 0)
+			break;
+		if (err > 0)
+			changed |= BIT(sel);
+	}
+	mutex_unlock(&katana_fu_mutex);
+	
+	for_each_set_bit(i, &changed, KATANA_FU_MAX) {
+		if (katana_fu_kctls[i])
+			snd_ctl_notify(kctl->private_data, SNDRV_CTL_EVENT_MASK_VALUE,
+				       &katana_fu_kctls[i]->id);
+	}
+	
+	return err < 0 ? err : !!changed;
+}
+
+static const struct {
+	int selector;
+	const char *name;
+} katana_tone_ctls[] = {
+	{ KATANA_FU_BASS, "Tone Control - Bass" },
+	{ KATANA_FU_MID, "Tone Control - Mid" },
+	{ KATANA_FU_TREBLE, "Tone Control - Treble" },
+	{ KATANA_FU_BASS_BOOST, "Bass Boost Playback Switch" },
+	{ KATANA_FU_LOUDNESS, "Loudness Playback Switch" },
+};
+
+struct snd_kcontrol_new katana_tone_ctl = {
+	.iface	       = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.index	       = 0,
+	.access	       = SNDRV_CTL_ELEM_ACCESS_READWRITE |
+			 SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+	.get	       = katana_tone_get,
+	.put	       = katana_tone_put,
+	.info	       = katana_tone_info,
+	.tlv.p	       = katana_tone_tlv,
+};
+
+struct snd_kcontrol_new katana_eq_preset_ctl = {
+	.iface	       = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name	       = "EQ Preset",
+	.index	       = 0,
+	.access	       = SNDRV_CTL_ELEM_ACCESS_READWRITE,
+	.get	       = katana_eq_preset_get,
+	.put	       = katana_eq_preset_put,
+	.info	       = katana_eq_preset_info,
+};
+
+// Add the tone controls Feature Unit 1 advertises, plus the preset
+// selector if there is at least one of them
+int katana_tone_add_controls(struct snd_card *card, struct usb_host_interface *alts)
+{
+	struct snd_kcontrol_new tmpl = katana_tone_ctl;
+	struct snd_kcontrol *kctl;
+	int i, err;
+	
+	katana_fu_controls = katana_parse_feature_unit(alts);
+	katana_fu_cached = 0;
+	memset(katana_fu_kctls, 0, sizeof(katana_fu_kctls));
+	katana_eq_preset_kctl = NULL;
+	
+	for (i = 0; i < ARRAY_SIZE(katana_tone_ctls); i++) {
+		int sel = katana_tone_ctls[i].selector;
+		
+		if (!(katana_fu_controls & BIT(sel - 1)))
+			continue;
+		
+		tmpl.name = katana_tone_ctls[i].name;
+		tmpl.private_value = sel;
+		tmpl.access = katana_fu_is_switch(sel) ? SNDRV_CTL_ELEM_ACCESS_READWRITE :
+			      katana_tone_ctl.access;
+		kctl = snd_ctl_new1(&tmpl, card);
+		if (!kctl)
+			return -ENOMEM;
+		err = snd_ctl_add(card, kctl);
+		if (err < 0)
+			return err;
+		katana_fu_kctls[sel] = kctl;
+	}
+	
+	if (!(katana_fu_controls & (BIT(KATANA_FU_BASS - 1) | BIT(KATANA_FU_MID - 1) |
+				    BIT(KATANA_FU_TREBLE - 1) | BIT(KATANA_FU_BASS_BOOST - 1) |
+				    BIT(KATANA_FU_LOUDNESS - 1)))) {
+		pr_debug("Katana Control: Feature unit has no tone controls (bmaControls 0x%x)\n",
+			 katana_fu_controls);
+		return 0;
+	}
+	
+	kctl = snd_ctl_new1(&katana_eq_preset_ctl, card);
+	if (!kctl)
+		return -ENOMEM;
+	err = snd_ctl_add(card, kctl);
+	if (err < 0)
+		return err;
+	katana_eq_preset_kctl = kctl;
+	return 0;
+}
+
+// Read the volume range and the current control state in the background,
+// so neither probe nor the first mixer access waits for them
+static void katana_prefetch_work_fn(struct work_struct *work)
+{
+	struct usb_device *usb_dev = katana_prefetch_dev;
+	int16_t volume;
+	int vol_err;
+	int mute;
+	
+	katana_init_volume_range(usb_dev);
+	
+	vol_err = katana_get_hardware_volume_raw(usb_dev, &volume);
+	mute = katana_get_hardware_mute(usb_dev);
+	
+	// Only successful reads are cached, failures are retried on access
+	mutex_lock(&katana_cache_mutex);
+	if (vol_err == 0) {
+		katana_vol_cached = volume;
+		katana_vol_stamp = jiffies;
+		katana_vol_valid = 1;
+	}
+	if (mute >= 0) {
+		katana_mute_cached = mute;
+		katana_mute_stamp = jiffies;
+		katana_mute_valid = 1;
+	}
+	mutex_unlock(&katana_cache_mutex);
+	
+	mutex_lock(&katana_fu_mutex);
+	katana_fu_fill_cache(usb_dev);
+	mutex_unlock(&katana_fu_mutex);
+	
+	katana_controls_ready_us = ktime_us_delta(ktime_get(), katana_prefetch_start);
+	pr_debug("Katana Control: Control state prefetched %llu us after probe\n",
+		 katana_controls_ready_us);
+	
+	katana_prefetch_dev = NULL;
+	usb_put_dev(usb_dev);
+}
+
+// Start prefetching control state; start is when probing began
+void katana_control_prefetch(struct usb_device *usb_dev, ktime_t start)
+{
+	katana_control_cancel_prefetch();
+	katana_vol_valid = 0;
+	katana_mute_valid = 0;
+	katana_prefetch_start = start;
+	katana_prefetch_dev = usb_get_dev(usb_dev);
+	if (!schedule_work(&katana_prefetch_work))
+		usb_put_dev(usb_dev);
+}
+
+// Wait for (or drop) a pending prefetch before the device goes away
+void katana_control_cancel_prefetch(void)
+{
+	if (cancel_work_sync(&katana_prefetch_work) && katana_prefetch_dev) {
+		usb_put_dev(katana_prefetch_dev);
+		katana_prefetch_dev = NULL;
+	}
+}
+
+// Mixer state remembered per device (by serial number) for the lifetime of
+// the module, so a replugged or resumed Katana comes back at the level it
+// was left at instead of the device default
+struct katana_mixer_state {
+	struct list_head list;
+	char key[64];             // Serial number, or the port path if there is none
+	int16_t volume;
+	int mute;
+	int trim_steps;
+	s8 tone[KATANA_FU_MAX];
+};
+
+static LIST_HEAD(katana_mixer_states);
+static DEFINE_MUTEX(katana_mixer_states_mutex);
+
+static void katana_mixer_key(struct usb_device *usb_dev, char *key, size_t len)
+{
+	if (usb_dev->serial && usb_dev->serial[0])
+		snprintf(key, len, "%s", usb_dev->serial);
+	else
+		snprintf(key, len, "path:%s", usb_dev->devpath);
+}
+
+// Find the saved state for a device (katana_mixer_states_mutex held)
+static struct katana_mixer_state *katana_find_mixer_state(const char *key)
+{
+	struct katana_mixer_state *state;
+	
+	list_for_each_entry(state, &katana_mixer_states, list) {
+		if (!strcmp(state->key, key))
+			return state;
+	}
+	return NULL;
+}
+
+// Remember the current mixer state. With refresh set (suspend) the device is
+// asked for its volume and mute first; on disconnect it's already gone, so
+// the last known values are used.
+void katana_control_save_state(struct usb_device *usb_dev, int refresh)
+{
+	struct katana_mixer_state *state;
+	char key[64];
+	
+	if (refresh) {
+		int16_t volume;
+		int vol_err = katana_get_hardware_volume_raw(usb_dev, &volume);
+		int mute = katana_get_hardware_mute(usb_dev);
+		
+		mutex_lock(&katana_cache_mutex);
+		if (vol_err == 0) {
+			katana_vol_cached = volume;
+			katana_vol_stamp = jiffies;
+			katana_vol_valid = 1;
+		}
+		if (mute >= 0) {
+			katana_mute_cached = mute;
+			katana_mute_stamp = jiffies;
+			katana_mute_valid = 1;
+		}
+		mutex_unlock(&katana_cache_mutex);
+	}
+	
+	// Nothing known yet - don't overwrite a good entry with defaults
+	if (!katana_vol_valid || !katana_mute_valid)
+		return;
+	
+	katana_mixer_key(usb_dev, key, sizeof(key));
+	
+	mutex_lock(&katana_mixer_states_mutex);
+	state = katana_find_mixer_state(key);
+	if (!state) {
+		state = kzalloc(sizeof(*state), GFP_KERNEL);
+		if (!state) {
+			mutex_unlock(&katana_mixer_states_mutex);
+			return;
+		}
+		strscpy(state->key, key, sizeof(state->key));
+		list_add(&state->list, &katana_mixer_states);
+	}
+	
+	mutex_lock(&katana_cache_mutex);
+	state->volume = katana_vol_cached;
+	state->mute = katana_mute_cached;
+	mutex_unlock(&katana_cache_mutex);
+	state->trim_steps = katana_trim_steps;
+	mutex_lock(&katana_fu_mutex);
+	memcpy(state->tone, katana_fu_cache, sizeof(state->tone));
+	mutex_unlock(&katana_fu_mutex);
+	mutex_unlock(&katana_mixer_states_mutex);
+	
+	pr_debug("Katana Control: Saved mixer state for %s (volume %d, mute %d)\n",
+		 key, state->volume, state->mute);
+}
+
+// Write a remembered mixer state back to the device in one sequence:
+// volume (both channels), mute, then each advertised tone control. Called
+// before the card is registered and on resume. Returns 0 if there was
+// nothing to restore.
+int katana_control_restore_state(struct usb_device *usb_dev)
+{
+	struct katana_mixer_state saved;
+	struct katana_mixer_state *state;
+	char key[64];
+	int err, i;
+	
+	katana_mixer_key(usb_dev, key, sizeof(key));
+	
+	mutex_lock(&katana_mixer_states_mutex);
+	state = katana_find_mixer_state(key);
+	if (state)
+		saved = *state;
+	mutex_unlock(&katana_mixer_states_mutex);
+	if (!state)
+		return 0;
+	
+	err = katana_set_hardware_volume_raw(usb_dev, saved.volume);
+	if (err == 0)
+		err = katana_set_hardware_mute(usb_dev, saved.mute);
+	if (err < 0) {
+		pr_warn("Katana Control: Failed to restore mixer state for %s: %d\n", key, err);
+		return err;
+	}
+	
+	mutex_lock(&katana_cache_mutex);
+	katana_vol_cached = saved.volume;
+	katana_mute_cached = saved.mute;
+	katana_vol_stamp = jiffies;
+	katana_mute_stamp = jiffies;
+	katana_vol_valid = 1;
+	katana_mute_valid = 1;
+	mutex_unlock(&katana_cache_mutex);
+	
+	// The device came back with its defaults, so every tone control is sent
+	mutex_lock(&katana_fu_mutex);
+	for (i = 0; i < ARRAY_SIZE(katana_fu_selectors); i++) {
+		int sel = katana_fu_selectors[i];
+		s8 value = saved.tone[sel];
+		
+		if (!(katana_fu_controls & BIT(sel - 1)))
+			continue;
+		if (katana_fu_request(usb_dev, 1, sel, &value) == 0)
+			katana_fu_cache[sel] = saved.tone[sel];
+	}
+	katana_fu_cached = 1;
+	mutex_unlock(&katana_fu_mutex);
+	
+	if (saved.trim_steps != katana_trim_steps)
+		katana_apply_trim(saved.trim_steps);
+	
+	pr_debug("Katana Control: Restored mixer state for %s\n", key);
+	return 1;
+}
+
+// Drop all remembered states (module unload)
+void katana_control_free_states(void)
+{
+	struct katana_mixer_state *state, *tmp;
+	
+	mutex_lock(&katana_mixer_states_mutex);
+	list_for_each_entry_safe(state, tmp, &katana_mixer_states, list) {
+		list_del(&state->list);
+		kfree(state);
+	}
+	mutex_unlock(&katana_mixer_states_mutex);
+}
+
+// Upper bound of the latency bucket holding the given percentile
+static u32 katana_ctrl_percentile(const struct katana_ctrl_stat *stat, unsigned int pct)
+{
+	u64 target = div_u64(stat->count * pct + 99, 100);
+	u64 seen = 0;
+	int b;
+	
+	for (b = 0; b < KATANA_LAT_BUCKETS - 1; b++) {
+		seen += stat->hist[b];
+		if (seen >= target)
+			return 1U << b;
+	}
+	return stat->max_us;
+}
+
+static int katana_ctrl_stats_show(struct seq_file *s, void *unused)
+{
+	struct katana_ctrl_stat stat;
+	unsigned long flags;
+	int ctl, req;
+	
+	seq_printf(s, "%-7s %-8s %8s %6s %8s %8s %8s %8s\n",
+		   "control", "request", "count", "errors", "avg_us", "p50_us", "p99_us", "max_us");
+	for (ctl = 0; ctl < KATANA_CTL_COUNT; ctl++) {
+		for (req = 0; req < KATANA_REQ_COUNT; req++) {
+			spin_lock_irqsave(&katana_ctrl_stats_lock, flags);
+			stat = katana_ctrl_stats[ctl][req];
+			spin_unlock_irqrestore(&katana_ctrl_stats_lock, flags);
+			
+			if (!stat.count)
+				continue;
+			seq_printf(s, "%-7s %-8s %8llu %6llu %8llu %8u %8u %8u\n",
+				   katana_ctl_names[ctl], katana_req_names[req],
+				   stat.count, stat.errors, div_u64(stat.total_us, stat.count),
+				   katana_ctrl_percentile(&stat, 50), katana_ctrl_percentile(&stat, 99),
+				   stat.max_us);
+		}
+	}
+	
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(katana_ctrl_stats);
+
+// Control-plane benchmark: writing N to control_bench does N volume reads
+// and N volume writes (of the current value, so nothing is audible) back to
+// back, the same path amixer and the sound server take. Reading the file
+// shows the last result. Percentiles here are exact.
+#define KATANA_BENCH_MAX 10000
+static DEFINE_MUTEX(katana_bench_mutex);
+static char katana_bench_result[256] = "no run yet, write an iteration count\n";
+
+static int katana_bench_cmp(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a, y = *(const u32 *)b;
+	
+	return x < y ? -1 : x > y;
+}
+
+static int katana_bench_run(struct usb_device *usb_dev, unsigned int n)
+{
+	u32 *lat;
+	ktime_t start, t;
+	int16_t volume, cur;
+	u64 total_us;
+	int len = 0;
+	unsigned int i;
+	int pass, err = 0;
+	
+	lat = kmalloc_array(n, sizeof(*lat), GFP_KERNEL);
+	if (!lat)
+		return -ENOMEM;
+	
+	err = katana_get_hardware_volume_raw(usb_dev, &volume);
+	if (err < 0)
+		goto out;
+	
+	for (pass = 0; pass < 2; pass++) {
+		start = ktime_get();
+		for (i = 0; i < n; i++) {
+			t = ktime_get();
+			if (pass == 0)
+				err = katana_get_hardware_volume_raw(usb_dev, &cur);
+			else
+				err = katana_set_hardware_volume_raw(usb_dev, volume);
+			lat[i] = ktime_us_delta(ktime_get(), t);
+			if (err < 0)
+				goto out;
+		}
+		total_us = max_t(u64, ktime_us_delta(ktime_get(), start), 1);
+		
+		sort(lat, n, sizeof(*lat), katana_bench_cmp, NULL);
+		len += scnprintf(katana_bench_result + len, sizeof(katana_bench_result) - len,
+				 "%s n=%u ops_per_s=%llu p50_us=%u p99_us=%u max_us=%u\n",
+				 pass == 0 ? "GET_CUR volume" : "SET_CUR volume (L+R)", n,
+				 div64_u64((u64)n * USEC_PER_SEC, total_us),
+				 lat[n / 2], lat[(n * 99) / 100], lat[n - 1]);
+	}
+	
+out:
+	kfree(lat);
+	return err;
+}
+
+static ssize_t katana_bench_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	struct snd_card *card = file->private_data;
+	unsigned int n;
+	int err;
+	
+	err = kstrtouint_from_user(buf, count, 0, &n);
+	if (err)
+		return err;
+	if (n == 0 || n > KATANA_BENCH_MAX)
+		return -EINVAL;
+	
+	// Keep disconnect from freeing the device under us
+	err = katana_enter_operation();
+	if (err < 0)
+		return err;
+	
+	mutex_lock(&katana_bench_mutex);
+	if (card->private_data)
+		err = katana_bench_run(card->private_data, n);
+	else
+		err = -ENODEV;
+	mutex_unlock(&katana_bench_mutex);
+	
+	katana_exit_operation();
+	return err < 0 ? err : count;
+}
+
+static ssize_t katana_bench_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	ssize_t ret;
+	
+	mutex_lock(&katana_bench_mutex);
+	ret = simple_read_from_buffer(buf, count, ppos, katana_bench_result,
+				      strlen(katana_bench_result));
+	mutex_unlock(&katana_bench_mutex);
+	return ret;
+}
+
+static const struct file_operations katana_bench_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = katana_bench_read,
+	.write = katana_bench_write,
+	.llseek = default_llseek,
+};
+
+// Volume/mute/trim controls, for change notifications from the hwdep batch
+static struct snd_kcontrol *katana_vol_kctl;
+static struct snd_kcontrol *katana_mute_kctl;
+static struct snd_kcontrol *katana_trim_kctl;
+
+void katana_control_track(struct snd_kcontrol *vol, struct snd_kcontrol *mute,
+			  struct snd_kcontrol *trim)
+{
+	katana_vol_kctl = vol;
+	katana_mute_kctl = mute;
+	katana_trim_kctl = trim;
+}
+
+// Fill the mixer part of a hwdep snapshot, from the caches where possible
+void katana_control_snapshot(struct usb_device *usb_dev, struct katana_hwdep_snapshot *snap)
+{
+	int16_t volume;
+	
+	katana_init_volume_range(usb_dev);
+	snap->volume_min = katana_vol_min;
+	snap->volume_max = katana_vol_max;
+	snap->volume_res = katana_vol_res;
+	
+	mutex_lock(&katana_cache_mutex);
+	if (!katana_vol_valid ||
+	    !time_before(jiffies, katana_vol_stamp + msecs_to_jiffies(KATANA_CACHE_MS))) {
+		if (katana_get_hardware_volume_raw(usb_dev, &volume) == 0) {
+			katana_vol_cached = volume;
+			katana_vol_stamp = jiffies;
+			katana_vol_valid = 1;
+		}
+	}
+	if (!katana_mute_valid ||
+	    !time_before(jiffies, katana_mute_stamp + msecs_to_jiffies(KATANA_CACHE_MS))) {
+		int mute = katana_get_hardware_mute(usb_dev);
+		
+		if (mute >= 0) {
+			katana_mute_cached = mute;
+			katana_mute_stamp = jiffies;
+			katana_mute_valid = 1;
+		}
+	}
+	snap->volume = katana_vol_cached;
+	snap->mute = katana_mute_cached;
+	mutex_unlock(&katana_cache_mutex);
+	
+	snap->trim_steps = katana_trim_steps;
+	
+	mutex_lock(&katana_fu_mutex);
+	katana_fu_fill_cache(usb_dev);
+	snap->tone_controls = katana_fu_controls;
+	memcpy(snap->tone, katana_fu_cache,
+	       min(sizeof(snap->tone), sizeof(katana_fu_cache)));
+	mutex_unlock(&katana_fu_mutex);
+}
+
+// Apply a hwdep batch. Everything is validated before anything is sent,
+// then the transfers go out back to back: volume (both channels), mute,
+// tone controls, trim. The first failing transfer ends the batch; steps
+// already applied stay applied. Either way, controls that changed are
+// announced afterwards.
+int katana_control_apply_batch(struct snd_card *card, const struct katana_hwdep_batch *batch)
+{
+	struct usb_device *usb_dev = card->private_data;
+	unsigned long tone_changed = 0;
+	unsigned int applied = 0;
+	unsigned int preset;
+	int preset_changed = 0;
+	int err = 0;
+	int i;
+	
+	if (batch->mask & ~(KATANA_BATCH_VOLUME | KATANA_BATCH_MUTE |
+			    KATANA_BATCH_TRIM | KATANA_BATCH_TONE))
+		return -EINVAL;
+	if ((batch->mask & KATANA_BATCH_TRIM) && batch->trim_steps > KATANA_TRIM_STEPS)
+		return -EINVAL;
+	if (batch->mask & KATANA_BATCH_TONE) {
+		for (i = 0; i < 32; i++) {
+			if (!(batch->tone_mask & BIT(i)))
+				continue;
+			if (i == 0 || i >= KATANA_FU_MAX || !(katana_fu_controls & BIT(i - 1)))
+				return -EINVAL;
+		}
+	}
+	
+	katana_init_volume_range(usb_dev);
+	if ((batch->mask & KATANA_BATCH_VOLUME) &&
+	    (batch->volume < katana_vol_min || batch->volume > katana_vol_max))
+		return -EINVAL;
+	
+	if (batch->mask & KATANA_BATCH_VOLUME) {
+		err = katana_set_hardware_volume_raw(usb_dev, batch->volume);
+		if (err < 0)
+			goto notify;
+		mutex_lock(&katana_cache_mutex);
+		katana_vol_cached = batch->volume;
+		katana_vol_stamp = jiffies;
+		katana_vol_valid = 1;
+		mutex_unlock(&katana_cache_mutex);
+		applied |= KATANA_BATCH_VOLUME;
+	}
+	
+	if (batch->mask & KATANA_BATCH_MUTE) {
+		err = katana_set_hardware_mute(usb_dev, batch->mute);
+		if (err < 0)
+			goto notify;
+		mutex_lock(&katana_cache_mutex);
+		katana_mute_cached = !!batch->mute;
+		katana_mute_stamp = jiffies;
+		katana_mute_valid = 1;
+		mutex_unlock(&katana_cache_mutex);
+		applied |= KATANA_BATCH_MUTE;
+	}
+	
+	if (batch->mask & KATANA_BATCH_TONE) {
+		mutex_lock(&katana_fu_mutex);
+		katana_fu_fill_cache(usb_dev);
+		preset = katana_eq_preset_match();
+		for (i = 1; i < KATANA_FU_MAX; i++) {
+			if (!(batch->tone_mask & BIT(i)))
+				continue;
+			err = katana_fu_update(usb_dev, i, batch->tone[i]);
+			if (err < 0)
+				break;
+			if (err > 0)
+				tone_changed |= BIT(i);
+		}
+		preset_changed = tone_changed && katana_eq_preset_match() != preset;
+		mutex_unlock(&katana_fu_mutex);
+		if (err < 0)
+			goto notify;
+	}
+	
+	if (batch->mask & KATANA_BATCH_TRIM) {
+		if (batch->trim_steps != katana_trim_steps)
+			katana_apply_trim(batch->trim_steps);
+		applied |= KATANA_BATCH_TRIM;
+	}
+	
+notify:
+	// Tell mixer clients what moved, including after a partial failure
+	if ((applied & KATANA_BATCH_VOLUME) && katana_vol_kctl)
+		snd_ctl_notify(card, SNDRV_CTL_EVENT_MASK_VALUE, &katana_vol_kctl->id);
+	if ((applied & KATANA_BATCH_MUTE) && katana_mute_kctl)
+		snd_ctl_notify(card, SNDRV_CTL_EVENT_MASK_VALUE, &katana_mute_kctl->id);
+	if ((applied & KATANA_BATCH_TRIM) && katana_trim_kctl)
+		snd_ctl_notify(card, SNDRV_CTL_EVENT_MASK_VALUE, &katana_trim_kctl->id);
+	for_each_set_bit(i, &tone_changed, KATANA_FU_MAX) {
+		if (katana_fu_kctls[i])
+			snd_ctl_notify(card, SNDRV_CTL_EVENT_MASK_VALUE, &katana_fu_kctls[i]->id);
+	}
+	if (preset_changed)
+		katana_eq_preset_changed(card);
+	
+	return err < 0 ? err : 0;
+}
+
+void katana_control_debugfs_init(struct dentry *root, struct snd_card *card)
+{
+	debugfs_create_u64("controls_ready_us", 0444, root, &katana_controls_ready_us);
+	debugfs_create_file("control_stats", 0444, root, NULL, &katana_ctrl_stats_fops);
+	debugfs_create_file("control_bench", 0600, root, card, &katana_bench_fops);
+}
@@ -1,10 +1,17 @@
 #pragma once
 
+#include <linux/usb.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
 #include <sound/control.h>
 
 // Control structure declarations
 extern struct snd_kcontrol_new katana_vol_ctl;
 extern struct snd_kcontrol_new katana_mute_ctl;
+extern struct snd_kcontrol_new katana_trim_ctl;
+extern struct snd_kcontrol_new katana_tone_ctl;
+extern struct snd_kcontrol_new katana_eq_preset_ctl;
+extern struct snd_kcontrol_new katana_meter_ctl;
 
 // Control function declarations
 int katana_volume_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
@@ -14,3 +21,38 @@ int katana_volume_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinf
 int katana_mute_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
 int katana_mute_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
 int katana_mute_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo);
+
+int katana_trim_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_trim_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_trim_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo);
+
+int katana_tone_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_tone_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_tone_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo);
+
+int katana_eq_preset_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_eq_preset_put(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_eq_preset_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo);
+
+int katana_meter_get(struct snd_kcontrol *kctl, struct snd_ctl_elem_value *ucontrol);
+int katana_meter_info(struct snd_kcontrol *kctl, struct snd_ctl_elem_info *uinfo);
+
+int katana_tone_add_controls(struct snd_card *card, struct usb_host_interface *alts);
+int katana_meter_add_controls(struct snd_card *card);
+void katana_control_meter_changed(int force);
+void katana_meter_remove_controls(void);
+
+void katana_control_prefetch(struct usb_device *usb_dev, ktime_t start);
+void katana_control_cancel_prefetch(void);
+void katana_control_debugfs_init(struct dentry *root, struct snd_card *card);
+
+void katana_control_save_state(struct usb_device *usb_dev, int refresh);
+int katana_control_restore_state(struct usb_device *usb_dev);
+void katana_control_free_states(void);
+
+struct katana_hwdep_snapshot;
+struct katana_hwdep_batch;
+void katana_control_track(struct snd_kcontrol *vol, struct snd_kcontrol *mute,
+			  struct snd_kcontrol *trim);
+void katana_control_snapshot(struct usb_device *usb_dev, struct katana_hwdep_snapshot *snap);
+int katana_control_apply_batch(struct snd_card *card, const struct katana_hwdep_batch *batch);
@@ -0,0 +1,90 @@
+#include <linux/init.h>
+#include <linux/compat.h>
+#include <linux/module.h>
+#include <linux/printk.h>
+#include <linux/uaccess.h>
+#include <linux/usb.h>
+#include <sound/core.h>
+#include <sound/hwdep.h>
+#include "hwdep.h"
+#include "control.h"
+#include "pcm.h"
+
+static int katana_hwdep_ioctl(struct snd_hwdep *hw, struct file *file,
+			      unsigned int cmd, unsigned long arg)
+{
+	struct snd_card *card = hw->private_data;
+	struct katana_hwdep_snapshot snap;
+	struct katana_hwdep_batch batch;
+	void __user *argp = (void __user *)arg;
+	int err;
+
+	if (cmd == KATANA_HWDEP_IOCTL_VERSION)
+		return put_user(KATANA_HWDEP_VERSION, (int __user *)argp);
+
+	// Check if disconnect is in progress
+	err = katana_enter_operation();
+	if (err < 0) {
+		return err;
+	}
+
+	if (!card->private_data) {
+		katana_exit_operation();
+		return -ENODEV;
+	}
+
+	switch (cmd) {
+	case KATANA_HWDEP_IOCTL_SNAPSHOT:
+		memset(&snap, 0, sizeof(snap));
+		snap.version = KATANA_HWDEP_VERSION;
+		katana_control_snapshot(card->private_data, &snap);
+		katana_pcm_snapshot(&snap);
+		err = copy_to_user(argp, &snap, sizeof(snap)) ? -EFAULT : 0;
+		break;
+
+	case KATANA_HWDEP_IOCTL_APPLY:
+		if (copy_from_user(&batch, argp, sizeof(batch))) {
+			err = -EFAULT;
+			break;
+		}
+		err = katana_control_apply_batch(card, &batch);
+		break;
+
+	default:
+		err = -ENOTTY;
+		break;
+	}
+
+	katana_exit_operation();
+	return err;
+}
+
+#ifdef CONFIG_COMPAT
+// The layouts are fixed-size and the same on 32-bit, only the pointer
+// needs converting
+static int katana_hwdep_ioctl_compat(struct snd_hwdep *hw, struct file *file,
+				     unsigned int cmd, unsigned long arg)
+{
+	return katana_hwdep_ioctl(hw, file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
+// Create the hwdep device (hwC<card>D0)
+int katana_hwdep_new(struct snd_card *card)
+{
+	struct snd_hwdep *hw;
+	int err;
+
+	err = snd_hwdep_new(card, "Katana", 0, &hw);
+	if (err < 0)
+		return err;
+
+	strcpy(hw->name, "SoundBlaster X Katana");
+	hw->private_data = card;
+	hw->ops.ioctl = katana_hwdep_ioctl;
+#ifdef CONFIG_COMPAT
+	hw->ops.ioctl_compat = katana_hwdep_ioctl_compat;
+#endif
+
+	return 0;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <sound/core.h>
+
+// Katana hwdep interface: one ioctl returns the whole device state, another
+// applies several mixer changes in one go. Userspace tools can copy these
+// definitions; the layout only grows at the end, with version bumped.
+
+#define KATANA_HWDEP_VERSION 2
+
+// Complete device state
+struct katana_hwdep_snapshot {
+	__u32 version;
+	__u32 reserved;
+
+	// Mixer (volume in the device's raw 1/256dB units)
+	__s16 volume;
+	__s16 volume_min;
+	__s16 volume_max;
+	__s16 volume_res;
+	__u8 mute;
+	__u8 trim_steps;          // Digital trim, 0.5dB steps up to 80 (0dB)
+	__u16 reserved2;
+	__u32 tone_controls;      // Feature unit bmaControls (bit n = selector n+1)
+	__s8 tone[16];            // Tone values by feature unit selector
+
+	// Stream (all zero when the PCM isn't open)
+	__u32 running;
+	__u32 rate;
+	__u32 dev_rate;
+	__u32 channels;
+	__u32 buffer_size;
+	__u32 period_size;
+	__u32 num_urbs;
+	__u32 urb_depth;
+	__u32 hw_ptr;
+	__u32 feedback_value;     // Samples per packet from feedback, 16.16 at any speed
+	__u32 feedback_samples;
+	__u32 feedback_valid;
+	__u32 jitter_us;
+	__u32 complete_max_us;
+
+	// Counters (see stream_stats in debugfs)
+	__u64 urbs_completed;
+	__u64 schedule_gaps;
+	__u64 frames_skipped;
+	__u64 packets_dropped;
+	__u64 frames_dropped;
+	__u64 xruns;
+	__u64 depth_grows;
+	__u64 depth_shrinks;
+	__u64 complete_overruns;
+};
+
+// Mixer changes applied together; only the fields named in mask are used.
+// Not atomic: if a transfer fails, the steps before it stay applied.
+#define KATANA_BATCH_VOLUME (1 << 0)
+#define KATANA_BATCH_MUTE   (1 << 1)
+#define KATANA_BATCH_TRIM   (1 << 2)
+#define KATANA_BATCH_TONE   (1 << 3)
+
+struct katana_hwdep_batch {
+	__u32 mask;
+	__s16 volume;
+	__u8 mute;
+	__u8 trim_steps;
+	__u32 tone_mask;          // Selectors to set (bit = selector)
+	__s8 tone[16];
+};
+
+#define KATANA_HWDEP_IOCTL_VERSION  _IOR('K', 0x00, int)
+#define KATANA_HWDEP_IOCTL_SNAPSHOT _IOR('K', 0x01, struct katana_hwdep_snapshot)
+#define KATANA_HWDEP_IOCTL_APPLY    _IOW('K', 0x02, struct katana_hwdep_batch)
+
+int katana_hwdep_new(struct snd_card *card);
@@ -5,6 +5,10 @@
 #include <linux/delay.h>
 #include <linux/completion.h>
 #include <linux/atomic.h>
+#include <linux/debugfs.h>
+#include <linux/mutex.h>
+#include <linux/ktime.h>
+#include <linux/version.h>
 #include <sound/control.h>
 #include <sound/core.h>
 #include <sound/pcm.h>
@@ -13,6 +17,7 @@
 #include "usb.h"
 #include "card.h"
 #include "pcm.h"
+#include "hwdep.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Print3M");
@@ -25,17 +30,27 @@ EXPORT_SYMBOL(katana_enter_operation);
 EXPORT_SYMBOL(katana_exit_operation);
 
 static struct snd_card *card = NULL;
+static struct dentry *debugfs_root = NULL;
 static int control_interface_ready = 0;
 static int stream_interface_ready = 0;
 
+// Interfaces may be probed in parallel (PROBE_PREFER_ASYNCHRONOUS), but
+// they share the card
+static DEFINE_MUTEX(probe_mutex);
+static ktime_t probe_start;        // When the first interface of the device was probed
+static u64 card_ready_us;          // Probe start to card registration
+
 // Disconnect synchronization
 static atomic_t disconnect_in_progress = ATOMIC_INIT(0);
 static atomic_t active_operations = ATOMIC_INIT(0);
 static DECLARE_COMPLETION(disconnect_completion);
 
 // Define supported devices (Katana only)
+// driver_info holds KATANA_QUIRK_* flags. Full/high speed, UAC1/UAC2 and
+// the clock source are detected from the descriptors, so other Katana
+// models can be bound through new_id (see README) before they get an entry.
 static struct usb_device_id usb_table[] = {
-	{ USB_DEVICE(KATANA_VENDOR_ID, KATANA_PRODUCT_ID) },
+	{ USB_DEVICE(KATANA_VENDOR_ID, KATANA_PRODUCT_ID), .driver_info = 0 },
 	{} // Terminator
 };
 
@@ -81,23 +96,28 @@ static int katana_usb_probe(struct usb_interface *iface, const struct usb_device
 	// Map the device's interface to the device itself and get its data
 	struct usb_device *dev = interface_to_usbdev(iface);
 
+	mutex_lock(&probe_mutex);
+
 	// Exit if this is not the desired interface
 	int ifnum = iface->cur_altsetting->desc.bInterfaceNumber;
-	dev_info(&iface->dev, "Processing interface %d (looking for %d and %d)\n", 
+	dev_dbg(&iface->dev, "Processing interface %d (looking for %d and %d)\n", 
 		 ifnum, AUDIO_CONTROL_IFACE_ID, AUDIO_STREAM_IFACE_ID);
 	
 	if (ifnum != AUDIO_CONTROL_IFACE_ID && ifnum != AUDIO_STREAM_IFACE_ID) {
-		dev_info(&iface->dev, "Wrong interface: %d\n", ifnum);
+		dev_dbg(&iface->dev, "Wrong interface: %d\n", ifnum);
 		goto __error;
 	}
 
-	dev_info(&iface->dev, "Attached to USB device %04X:%04X\n", dev->descriptor.idVendor,
+	dev_dbg(&iface->dev, "Attached to USB device %04X:%04X\n", dev->descriptor.idVendor,
 		 dev->descriptor.idProduct);
 
 	int err;
 
 	// Create a new ALSA card structure if not already created
 	if (card == NULL) {
+		probe_start = ktime_get();
+		card_ready_us = 0;
+
 		// Find first free index for a new ALSA card
 		int idx = 0;
 		while (snd_card_ref(idx) != NULL) {
@@ -119,7 +139,13 @@ static int katana_usb_probe(struct usb_interface *iface, const struct usb_device
 		// Store the USB device in the card's private data for PCM operations
 		card->private_data = dev;
 
-		dev_info(&iface->dev, "New ALSA card created: %s\n", card->longname);
+		dev_dbg(&iface->dev, "New ALSA card created: %s\n", card->longname);
+
+		// Diagnostics live under /sys/kernel/debug/katana_usb_audio
+		debugfs_root = debugfs_create_dir("katana_usb_audio", NULL);
+		katana_pcm_debugfs_init(debugfs_root);
+		katana_control_debugfs_init(debugfs_root, card);
+		debugfs_create_u64("card_ready_us", 0444, debugfs_root, &card_ready_us);
 	}
 
 	// Setup Audio Control component
@@ -154,14 +180,59 @@ static int katana_usb_probe(struct usb_interface *iface, const struct usb_device
 			goto __error;
 		}
 
+		// Init digital trim control
+		struct snd_kcontrol *kctl_trim = snd_ctl_new1(&katana_trim_ctl, card);
+		if (kctl_trim == NULL) {
+			dev_err(&iface->dev, "Trim control creation failed\n");
+			goto __error;
+		}
+
+		// Attach digital trim control
+		err = snd_ctl_add(card, kctl_trim);
+		if (err != 0) {
+			dev_err(&iface->dev, "Adding trim control failed: %d\n", err);
+			snd_ctl_free_one(kctl_trim);
+			goto __error;
+		}
+
+		// Onboard tone controls, if the feature unit has any
+		err = katana_tone_add_controls(card, iface->cur_altsetting);
+		if (err != 0) {
+			dev_err(&iface->dev, "Adding tone controls failed: %d\n", err);
+			goto __error;
+		}
+		katana_control_track(kctl_vol, kctl_mute, kctl_trim);
+
+		// Level meters fed by the PCM fill path
+		err = katana_meter_add_controls(card);
+		if (err != 0) {
+			dev_err(&iface->dev, "Adding meter controls failed: %d\n", err);
+			goto __error;
+		}
+
+		// Snapshot/batch interface for management tools
+		err = katana_hwdep_new(card);
+		if (err != 0) {
+			dev_err(&iface->dev, "hwdep device creation failed: %d\n", err);
+			goto __error;
+		}
+
 		control_interface_ready = 1;
-		dev_info(&iface->dev, "Audio controls added successfully\n");
+		dev_dbg(&iface->dev, "Audio controls added successfully\n");
+
+		// Put back the mixer state this Katana had when it was unplugged,
+		// before userspace can see the card
+		katana_control_restore_state(dev);
+
+		// Volume range and current state are read in the background
+		katana_control_prefetch(dev, probe_start);
 	}
 
 	// Setup Audio Stream component
 	if (ifnum == AUDIO_STREAM_IFACE_ID && !stream_interface_ready) {
 		// Create PCM device
 		struct snd_pcm *pcm;
+		katana_pcm_set_quirks(id->driver_info);
 		err = katana_pcm_new(card, &pcm);
 		if (err != 0) {
 			dev_err(&iface->dev, "PCM device creation failed: %d\n", err);
@@ -169,7 +240,7 @@ static int katana_usb_probe(struct usb_interface *iface, const struct usb_device
 		}
 		
 		stream_interface_ready = 1;
-		dev_info(&iface->dev, "PCM device created successfully\n");
+		dev_dbg(&iface->dev, "PCM device created successfully\n");
 	}
 	
 		// Register the card only after both interfaces are ready
@@ -179,16 +250,17 @@ static int katana_usb_probe(struct usb_interface *iface, const struct usb_device
 			dev_err(&iface->dev, "ALSA card registration failed: %d\n", err);
 			goto __error;
 		}
-		dev_info(&iface->dev, "ALSA card registered successfully with all components\n");
+		card_ready_us = ktime_us_delta(ktime_get(), probe_start);
+		dev_info(&iface->dev, "ALSA card registered in %llu us\n", card_ready_us);
 	} else {
-		dev_info(&iface->dev, "Interface %d processed, waiting for other interface...\n", ifnum);
+		dev_dbg(&iface->dev, "Interface %d processed, waiting for other interface...\n", ifnum);
 	}
 
-	dev_info(&iface->dev, "Everything works. Ifnum: %d\n", ifnum);
-
+	mutex_unlock(&probe_mutex);
 	return 0; // SUCCESS - there is a match
 
 __error:
+	mutex_unlock(&probe_mutex);
 	// Standard error if the driver doesn't want to work with this interface
 	return -ENODEV;
 }
@@ -201,6 +273,8 @@ static void katana_usb_disconnect(struct usb_interface *iface)
 	*/
 	struct usb_device *dev = interface_to_usbdev(iface);
 	
+	mutex_lock(&probe_mutex);
+	
 	if (card) {
 	
 		
@@ -226,6 +300,12 @@ static void katana_usb_disconnect(struct usb_interface *iface)
 		}
 		
 		// Step 4: Now it's safe to free the card
+		katana_control_cancel_prefetch();
+		katana_control_save_state(dev, 0);
+		katana_meter_remove_controls();
+		katana_pcm_tap_close();
+		debugfs_remove_recursive(debugfs_root);
+		debugfs_root = NULL;
 		snd_card_free(card);
 		card = NULL;
 		
@@ -236,8 +316,29 @@ static void katana_usb_disconnect(struct usb_interface *iface)
 	
 	control_interface_ready = 0;
 	stream_interface_ready = 0;
+	mutex_unlock(&probe_mutex);
 	
-	dev_info(&dev->dev, "The driver has been disconnected\n");
+	dev_dbg(&dev->dev, "The driver has been disconnected\n");
+}
+
+static int katana_usb_suspend(struct usb_interface *iface, pm_message_t message)
+{
+	// Mixer state is kept with the AudioControl interface
+	if (iface->cur_altsetting->desc.bInterfaceNumber != AUDIO_CONTROL_IFACE_ID || !card)
+		return 0;
+	
+	katana_control_save_state(interface_to_usbdev(iface), 1);
+	return 0;
+}
+
+static int katana_usb_resume(struct usb_interface *iface)
+{
+	// The device may have lost power; put the mixer state back
+	if (iface->cur_altsetting->desc.bInterfaceNumber != AUDIO_CONTROL_IFACE_ID || !card)
+		return 0;
+	
+	katana_control_restore_state(interface_to_usbdev(iface));
+	return 0;
 }
 
 // Main USB driver structure
@@ -245,12 +346,34 @@ static struct usb_driver usb_ac_driver = {
 	.name	    = "katana_usb_audio",    // Should be unique and the same as the module name
 	.probe	    = katana_usb_probe,	     // See if the driver is willing to work with the iface
 	.disconnect = katana_usb_disconnect, // Called when the interface is no longer accessible
+	.suspend    = katana_usb_suspend,    // Remember the mixer state
+	.resume     = katana_usb_resume,     // Restore the mixer state
+	.reset_resume = katana_usb_resume,   // Same, after the device was reset
 	.id_table   = usb_table,	     // Required or the driver's probe will never get called
+	// Don't hold up boot or other devices behind our USB control requests
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#else
+	.drvwrap.driver.probe_type = PROBE_PREFER_ASYNCHRONOUS,
+#endif
 };
 
 /*
-	This is a shortcut to avoid boilerplate __init and __exit functions to
-	only register (usb_register) and deregister (usb_deregister) the USB driver.
-	This helper handles it automatically.
+	Register (usb_register) and deregister (usb_deregister) the USB driver.
+	module_usb_driver() would do just that, but the remembered mixer states
+	have to be freed on unload as well.
 */
-module_usb_driver(usb_ac_driver);
\ No newline at end of file
+static int __init katana_usb_init(void)
+{
+	return usb_register(&usb_ac_driver);
+}
+
+static void __exit katana_usb_exit(void)
+{
+	usb_deregister(&usb_ac_driver);
+	katana_control_free_states();
+	katana_pcm_telemetry_free();
+}
+
+module_init(katana_usb_init);
+module_exit(katana_usb_exit);
\ No newline at end of file
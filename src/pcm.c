@@ -2,21 +2,209 @@
 #include <linux/slab.h>
 #include <linux/dma-mapping.h>
 #include <linux/jiffies.h>
+#include <linux/ktime.h>
 #include <linux/usb.h>
 #include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/random.h>
+#include <linux/math64.h>
+#include <linux/kernel.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/atomic.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/fixp-arith.h>
+#include <linux/relay.h>
+#include <linux/mutex.h>
+#include <linux/timer.h>
+#include <linux/version.h>
+#include <linux/pm_qos.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 12, 0)
+#include <linux/unaligned.h>
+#else
+#include <asm/unaligned.h>
+#endif
 #include <sound/pcm.h>
 #include <sound/pcm_params.h>
 #include <sound/core.h>
 #include <sound/initval.h>
 #include "pcm.h"
+#include "control.h"
+#include "hwdep.h"
 #include "usb.h"
 
+// How long .sync_stop waits for unlinked URBs before killing them
+#define KATANA_STOP_TIMEOUT_MS 1000
+
+// URB ring geometry: 6 URBs of 8 packets (8ms) each
+#define KATANA_NUM_URBS 6
+#define KATANA_PACKETS_PER_URB 8
+
+// Upper bound on URBs in the streaming ring (tracked in a bitmask)
+#define KATANA_MAX_URBS 16
+
+// Adaptive URB depth tuning
+#define KATANA_MIN_URBS 2              // Never run with fewer URBs in flight
+#define KATANA_ADAPT_WINDOW 128        // Completions per evaluation window (~1s)
+#define KATANA_ADAPT_CALM_WINDOWS 4    // Calm windows needed before shrinking
+
+// 44.1kHz family resampling: 147 source frames per 160 device frames
+// (44100 -> 48000, 88200 -> 96000 and 176400 -> 192000), interpolated
+// with one 4-tap polyphase filter bank per output phase
+#define KATANA_RS_PHASES 160
+#define KATANA_RS_STEP 147
+#define KATANA_RS_TAPS 4
+
+// Host controllers report start_frame modulo their periodic schedule size,
+// which is at least 1024 frames on the EHCI and xHCI controllers we see.
+#define KATANA_FRAME_MASK 0x3ff
+
+// UAC2 class-specific entities and requests
+#define KATANA_UAC_VERSION_2 0x20      // bInterfaceProtocol of UAC2 interfaces
+#define KATANA_UAC2_CLOCK_SOURCE 0x0a  // AC interface descriptor subtype
+#define KATANA_UAC2_CUR 0x01
+#define KATANA_UAC2_RANGE 0x02
+#define KATANA_UAC2_SAM_FREQ 0x01      // Clock source control selector
+#define KATANA_UAC2_MAX_SUBRANGES 16
+
+// While idling on silence the pointers move in steps of this many ms
+#define KATANA_IDLE_TICK_MS 10
+
+// Latency budgets above this are left to cpuidle, no deep state exits that slowly
+#define KATANA_QOS_CEILING_US 2000
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define timer_delete del_timer
+#define timer_delete_sync del_timer_sync
+#endif
+
+static bool xrun_on_gap = true;
+module_param(xrun_on_gap, bool, 0644);
+MODULE_PARM_DESC(xrun_on_gap, "Raise an xrun when isochronous frames are skipped or dropped (default: true)");
+
+static bool adaptive_urbs;
+module_param(adaptive_urbs, bool, 0644);
+MODULE_PARM_DESC(adaptive_urbs, "Tune the number of in-flight URBs from observed scheduling jitter (default: false)");
+
+static bool rt_fill = IS_ENABLED(CONFIG_PREEMPT_RT);
+module_param(rt_fill, bool, 0644);
+MODULE_PARM_DESC(rt_fill, "Copy audio into URBs from a SCHED_FIFO kthread instead of the completion callback (default: on for PREEMPT_RT)");
+
+static bool resample = true;
+module_param(resample, bool, 0444);
+MODULE_PARM_DESC(resample, "Offer 44100/88200 Hz by resampling to 48000/96000 Hz in the driver (default: true)");
+
+static bool dither = true;
+module_param(dither, bool, 0644);
+MODULE_PARM_DESC(dither, "Add TPDF dither when the digital trim attenuates (default: true)");
+
+static unsigned int complete_budget_us = 100;
+module_param(complete_budget_us, uint, 0644);
+MODULE_PARM_DESC(complete_budget_us, "Warn when a URB completion callback runs longer than this, 0 to disable (default: 100)");
+
+static unsigned int idle_silence_ms;
+module_param(idle_silence_ms, uint, 0644);
+MODULE_PARM_DESC(idle_silence_ms, "Stop USB streaming after this much continuous digital silence, 0 to disable (default: 0)");
+
+static bool latency_qos = true;
+module_param(latency_qos, bool, 0644);
+MODULE_PARM_DESC(latency_qos, "Hold a CPU latency QoS request while the in-flight URB margin is tight (default: true)");
+
+static bool resume_latency_qos;
+module_param(resume_latency_qos, bool, 0644);
+MODULE_PARM_DESC(resume_latency_qos, "Also limit the USB device's resume latency to the same budget (default: false)");
+
+// Device table quirks (driver_info) of the bound device
+static unsigned long katana_quirks;
+
+// Digital trim gain in Q2.30, set from the "Digital Playback Volume" control
+#define KATANA_GAIN_UNITY (1U << 30)
+static u32 katana_trim_gain = KATANA_GAIN_UNITY;
+
+// Level meters: per-channel peak and RMS of the last period sent to the
+// device, read by the meter controls
+#define KATANA_METER_CHANNELS 2
+static DEFINE_RAW_SPINLOCK(katana_meter_lock);
+static u32 katana_meter_peak[KATANA_METER_CHANNELS];
+static u32 katana_meter_rms[KATANA_METER_CHANNELS];
+
+// Built-in test signals, selected through debugfs test_signal. While one is
+// active the fill path generates the audio instead of reading the PCM buffer.
+enum katana_test_signal {
+	KATANA_TEST_OFF,
+	KATANA_TEST_COUNTER,  // 24-bit frame counter left, its complement right
+	KATANA_TEST_SINE,     // 1kHz at -6dBFS on both channels
+	KATANA_TEST_PRBS,     // 32-bit Galois LFSR, one step per sample
+};
+static const char * const katana_test_names[] = { "off", "counter", "sine", "prbs" };
+static int katana_test_signal = KATANA_TEST_OFF;
+#define KATANA_TEST_SINE_HZ 1000
+#define KATANA_TEST_PRBS_TAPS 0x80200003  // x^32 + x^22 + x^2 + x + 1
+
+// Resampler filter bank, Q14 Catmull-Rom taps for each output phase
+static s16 katana_rs_coef[KATANA_RS_PHASES][KATANA_RS_TAPS];
+
+// Streaming statistics, kept across streams and exposed through debugfs
+static struct katana_stream_stats {
+	unsigned long urbs_completed;
+	unsigned long schedule_gaps;    // Completed URBs that didn't start where the previous one ended
+	unsigned long frames_skipped;   // USB frames the host controller skipped between URBs
+	unsigned long packets_dropped;  // Packets completed with an error status (e.g. -EXDEV)
+	unsigned long frames_dropped;   // Audio frames lost in dropped packets
+	unsigned long xruns;            // Xruns raised because stream continuity broke
+	unsigned int urb_depth;         // Data URBs currently kept in flight
+	unsigned int jitter_us;         // Worst completion-interval deviation, last window
+	unsigned long depth_grows;      // Adaptive depth increases (near misses)
+	unsigned long depth_shrinks;    // Adaptive depth decreases
+	unsigned int complete_max_us;   // Longest data URB completion callback
+	unsigned long complete_overruns; // Completions over complete_budget_us
+	unsigned long idle_entries;     // Times streaming stopped on silence
+	unsigned long idle_wakeups;     // Times streaming restarted for sound
+	unsigned long test_frames;      // Frames produced by the test signal generator
+	unsigned long tap_records;      // URBs recorded by the wire tap
+	unsigned long tap_dropped;      // URBs the wire tap had no room for
+	unsigned int qos_us;            // CPU latency QoS budget held, 0 when none
+	unsigned long qos_updates;      // Times the held budget changed
+} katana_stats;
+
+// Per-URB telemetry ring (layout in pcm.h), allocated with the debugfs files
+static struct katana_telemetry_header *katana_telemetry;
+static atomic64_t katana_telemetry_head = ATOMIC64_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(katana_telemetry_wait);
+#define KATANA_TELEMETRY_BYTES PAGE_ALIGN(sizeof(struct katana_telemetry_header) + \
+	KATANA_TELEMETRY_RECORDS * sizeof(struct katana_telemetry_record))
+
+// Wire tap relay channel (layout in pcm.h), opened on first enable. The raw
+// lock keeps the channel from closing under a writer and serializes
+// relay_reserve() against other CPUs.
+#define KATANA_TAP_SUBBUF_SIZE (64 * 1024)
+#define KATANA_TAP_SUBBUFS 8
+static struct rchan *katana_tap_chan;
+static bool katana_tap_on;
+static u32 katana_tap_seq;
+static DEFINE_RAW_SPINLOCK(katana_tap_lock);
+static DEFINE_MUTEX(katana_tap_mutex);  // Serializes enable/disable/close
+static struct dentry *katana_debugfs_root;
+
+// The card's PCM, for the hwdep snapshot
+static struct snd_pcm *katana_pcm;
+
 // Private data structure for our PCM device
 struct katana_pcm_data {
 	struct snd_card *card;
 	struct snd_pcm_substream *substream;
 	struct usb_device *usb_dev;
-	spinlock_t lock;
+	// Raw so it stays a spinning lock on PREEMPT_RT. Only pointer and
+	// state updates happen under it - no USB core calls, no copies.
+	raw_spinlock_t lock;
 	
 	// USB device state tracking
 	int usb_dev_valid;  // Track if USB device is still valid
@@ -27,12 +215,41 @@ struct katana_pcm_data {
 	unsigned int endpoint_sync;      // Sync endpoint address (for feedback)
 	int altsetting_num;             // Alternate setting number for the endpoint
 	
+	// Bus timing and class version, from the descriptors at open
+	int high_speed;                // Packets are timed in 125us microframes
+	int uac2;                      // UAC2 streaming interface, rate set on a clock source
+	unsigned int clock_id;         // UAC2 clock source entity
+	unsigned int datainterval;     // Data packet period is 2^datainterval (micro)frames
+	unsigned int packets_per_sec;  // Data packets per second
+	unsigned int sync_interval;    // Feedback packet period, in (micro)frames
+	unsigned int rate_list[12];    // Rates offered to ALSA (UAC2)
+	struct snd_pcm_hw_constraint_list rate_constraints;
+	
 	// URB management for USB audio streaming
 	struct urb **urbs;        // Array of URBs for streaming
 	int num_urbs;            // Number of URBs
 	int urb_buffer_size;     // Size of each URB buffer
 	unsigned char **urb_buffers; // URB data buffers
 	dma_addr_t *urb_dma_addrs;   // DMA addresses for URB buffers
+	unsigned int urb_src_frames[KATANA_MAX_URBS]; // PCM frames consumed by each in-flight URB
+	unsigned int urb_silence_frames[KATANA_MAX_URBS]; // Silence padding in each in-flight URB
+	unsigned int urb_fill_feedback[KATANA_MAX_URBS]; // Feedback value each in-flight URB was filled with
+	u32 dither_seed;          // xorshift state for the trim dither
+	
+	// 44.1kHz family resampler state. Fills are serialized (completion
+	// giveback or the single fill worker), so this isn't locked.
+	unsigned int rs_phase;    // Output position between rs_hist[1] and [2], in 1/KATANA_RS_PHASES
+	s32 rs_hist[KATANA_RS_TAPS][2]; // Last source frames, oldest first
+	
+	// Level meter accumulators for the current period (serialized like
+	// the resampler state)
+	u32 meter_peak[KATANA_METER_CHANNELS];
+	u64 meter_sum[KATANA_METER_CHANNELS];
+	unsigned int meter_frames;
+	
+	// Test signal generator state, reset at TRIGGER_START
+	u32 test_count;           // Frames generated (counter, sine phase)
+	u32 test_lfsr;            // PRBS register
 	
 	// Synchronization endpoint management
 	struct urb *sync_urb;     // URB for sync endpoint feedback
@@ -43,6 +260,9 @@ struct katana_pcm_data {
 	// CRITICAL: Feedback processing for proper timing
 	unsigned int feedback_value;     // Latest feedback value from device
 	unsigned int feedback_samples;   // Samples per frame from feedback
+	u32 feedback_q16;                // Samples per packet from feedback, Q16
+	u32 packet_phase;                // Fractional samples carried between packets, Q16
+	unsigned int packet_max_frames;  // Largest packet the URB buffers hold
 	unsigned int target_samples;     // Target samples per URB based on feedback
 	unsigned int feedback_count;     // Number of feedback samples received
 	unsigned int feedback_average;   // Running average of feedback values
@@ -54,12 +274,20 @@ struct katana_pcm_data {
 	unsigned int period_bytes;
 	unsigned int channels;
 	unsigned int rate;
+	unsigned int dev_rate;    // Rate the device runs at (differs from rate when resampling)
+	int resampling;           // rate is 44.1kHz family, converted in the fill
+	int native_44k;           // Device descriptors list a 44.1kHz family rate
 	unsigned int format;
 	
 	// Hardware pointer tracking
 	unsigned int hw_ptr;      // Where hardware has finished playing
 	unsigned int last_period_hw_ptr; // Last hw_ptr when we called period_elapsed
 	unsigned int read_ptr;    // Where we should read from PCM buffer next
+	snd_pcm_uframes_t read_abs; // read_ptr in ALSA's boundary-wrapped frame space
+	
+	// Isochronous schedule tracking
+	int next_frame;           // Frame the next completed URB should start at
+	int next_frame_valid;     // Whether next_frame has been established
 	
 	// Playback status
 	int running;
@@ -67,7 +295,36 @@ struct katana_pcm_data {
 	
 	// URB streaming state
 	int stream_started;
-	int active_urbs;
+	int stopping;                  // STOP issued, URBs still draining
+	unsigned long urbs_in_flight;  // Bitmask of data URBs owned by the USB core
+	int sync_in_flight;            // Whether the sync URB is owned by the USB core
+	wait_queue_head_t stop_wait;   // Woken when the last in-flight URB retires
+	
+	// Optional RT fill worker
+	struct kthread_worker *fill_worker; // NULL when filling inline
+	struct kthread_work fill_work;
+	unsigned long fill_pending;    // Claimed data URBs waiting for the worker
+	
+	// Adaptive URB depth
+	unsigned int target_urbs;      // Data URBs we want in flight
+	unsigned int urb_period_us;    // Nominal time covered by one URB
+	ktime_t last_complete;         // When the previous data URB completed
+	unsigned int window_jitter_us; // Worst completion-interval deviation this window
+	unsigned int window_margin;    // Fewest pending PCM frames seen this window
+	unsigned int window_count;     // Completions seen this window
+	unsigned int calm_windows;     // Consecutive windows that allowed shrinking
+	
+	// Silence idling: URBs parked, idle_timer moves the pointers instead
+	int idle;                      // Idling (or draining towards it)
+	unsigned int silent_frames;    // Consecutive all-zero PCM frames sent
+	ktime_t idle_start;            // When the last URB retired, 0 while draining
+	u64 idle_frames;               // Frames accounted for since idle_start
+	struct timer_list idle_timer;
+	
+	// Latency QoS, applied by qos_work as the requests may sleep
+	struct work_struct qos_work;
+	struct pm_qos_request cpu_qos;
+	struct dev_pm_qos_request dev_qos;
 	
 	// Timing for hardware pointer simulation
 	unsigned long start_time;
@@ -105,6 +362,15 @@ static const struct snd_pcm_hw_constraint_list katana_rate_constraints = {
 	.list = katana_rates,
 };
 
+static const unsigned int katana_resample_rates[] = {
+	44100, 48000, 88200, 96000  // 44.1kHz family converted in the fill path
+};
+
+static const struct snd_pcm_hw_constraint_list katana_resample_rate_constraints = {
+	.count = ARRAY_SIZE(katana_resample_rates),
+	.list = katana_resample_rates,
+};
+
 static const unsigned int katana_channels[] = {
 	2
 };
@@ -135,6 +401,47 @@ static int katana_buffer_constraint(struct snd_pcm_hw_params *params,
 	return 0;
 }
 
+// Work out packet timing from the bus speed and endpoint descriptors
+// Full speed packets go out every 1ms frame. High speed endpoints are
+// timed in 125us microframes, with a period of 2^(bInterval - 1).
+static void katana_setup_timing(struct katana_pcm_data *data, unsigned int data_binterval,
+				unsigned int sync_binterval)
+{
+	data->high_speed = data->usb_dev->speed >= USB_SPEED_HIGH;
+	if (data->high_speed) {
+		data->datainterval = clamp_t(unsigned int, data_binterval, 1, 4) - 1;
+		data->packets_per_sec = 8000 >> data->datainterval;
+		data->sync_interval = 1 << (clamp_t(unsigned int, sync_binterval, 1, 8) - 1);
+	} else {
+		data->datainterval = 0;
+		data->packets_per_sec = 1000;
+		data->sync_interval = 1;
+	}
+}
+
+// Find the UAC2 clock source among the AudioControl interface descriptors
+// Katana models have a single clock, so the first one drives the stream.
+static int katana_find_clock(struct katana_pcm_data *data)
+{
+	struct usb_interface *ac_iface = usb_ifnum_to_if(data->usb_dev, AUDIO_CONTROL_IFACE_ID);
+	unsigned char *p;
+	int left;
+	
+	if (!ac_iface)
+		return -ENODEV;
+	
+	p = ac_iface->altsetting[0].extra;
+	left = ac_iface->altsetting[0].extralen;
+	for (; left >= 2 && p[0] >= 2 && p[0] <= left; left -= p[0], p += p[0]) {
+		// CS_INTERFACE, CLOCK_SOURCE; bClockID follows the subtype
+		if (p[0] >= 8 && p[1] == 0x24 && p[2] == KATANA_UAC2_CLOCK_SOURCE) {
+			data->clock_id = p[3];
+			return 0;
+		}
+	}
+	return -ENODEV;
+}
+
 // Find the audio streaming endpoint
 static int katana_find_audio_endpoint(struct katana_pcm_data *data)
 {
@@ -142,6 +449,8 @@ static int katana_find_audio_endpoint(struct katana_pcm_data *data)
 	struct usb_interface *iface = NULL;
 	struct usb_host_interface *altsetting;
 	struct usb_endpoint_descriptor *ep_desc;
+	unsigned int data_binterval = 1;
+	unsigned int sync_binterval = 1;
 	int i, j;
 	
 	// Find the audio streaming interface (interface 1)
@@ -183,6 +492,7 @@ static int katana_find_audio_endpoint(struct katana_pcm_data *data)
 			if (usb_endpoint_is_bulk_out(ep_desc) || usb_endpoint_is_isoc_out(ep_desc)) {
 				data->endpoint_out = ep_desc->bEndpointAddress;
 				data->altsetting_num = altsetting->desc.bAlternateSetting;
+				data_binterval = ep_desc->bInterval;
 				pr_debug("Katana PCM: Found audio data endpoint: 0x%02x (altsetting %d, 48kHz)\n",
 					data->endpoint_out, data->altsetting_num);
 			}
@@ -191,6 +501,7 @@ static int katana_find_audio_endpoint(struct katana_pcm_data *data)
 			if (usb_endpoint_is_isoc_in(ep_desc)) {
 				data->endpoint_sync = ep_desc->bEndpointAddress;
 				data->sync_packet_size = le16_to_cpu(ep_desc->wMaxPacketSize);
+				sync_binterval = ep_desc->bInterval;
 				pr_debug("Katana PCM: Found sync feedback endpoint: 0x%02x (packet size %u)\n",
 					data->endpoint_sync, data->sync_packet_size);
 			}
@@ -200,6 +511,17 @@ static int katana_find_audio_endpoint(struct katana_pcm_data *data)
 		if (data->endpoint_out && data->endpoint_sync) {
 			pr_debug("Katana PCM: Found both data (0x%02x) and sync (0x%02x) endpoints in altsetting %d\n",
 				data->endpoint_out, data->endpoint_sync, data->altsetting_num);
+			katana_setup_timing(data, data_binterval, sync_binterval);
+			
+			// UAC2 streams take their rate from a clock source entity
+			data->uac2 = altsetting->desc.bInterfaceProtocol == KATANA_UAC_VERSION_2;
+			if (data->uac2 && katana_find_clock(data) < 0) {
+				pr_err("Katana PCM: UAC2 device without a clock source\n");
+				return -ENODEV;
+			}
+			pr_debug("Katana PCM: %s speed, UAC%d, %u packets/s, feedback every %u\n",
+				 data->high_speed ? "High" : "Full", data->uac2 ? 2 : 1,
+				 data->packets_per_sec, data->sync_interval);
 			return 0;
 		}
 	}
@@ -229,12 +551,103 @@ static int katana_set_interface_altsetting(struct katana_pcm_data *data, int alt
 	return 0;
 }
 
+// Set the sample rate on the UAC2 clock source
+// bmRequestType 0x21: class request, interface recipient, host-to-device.
+// wValue selects the sampling frequency control, wIndex addresses the clock
+// entity on the AudioControl interface. The rate is 4 bytes little-endian.
+static int katana_uac2_set_rate(struct katana_pcm_data *data, unsigned int rate)
+{
+	__le32 *freq;
+	int err;
+	
+	freq = kmalloc(sizeof(*freq), GFP_KERNEL);
+	if (!freq)
+		return -ENOMEM;
+	*freq = cpu_to_le32(rate);
+	
+	err = usb_control_msg(data->usb_dev,
+			      usb_sndctrlpipe(data->usb_dev, 0),
+			      KATANA_UAC2_CUR,
+			      0x21,
+			      KATANA_UAC2_SAM_FREQ << 8,
+			      (data->clock_id << 8) | AUDIO_CONTROL_IFACE_ID,
+			      freq,
+			      sizeof(*freq),
+			      1000);
+	kfree(freq);
+	
+	if (err < 0) {
+		pr_err("Katana PCM: Failed to set clock %u to %u Hz: %d\n", data->clock_id, rate, err);
+		return err;
+	}
+	
+	pr_debug("Katana PCM: Set clock %u to %u Hz\n", data->clock_id, rate);
+	return 0;
+}
+
+// Read the rates a UAC2 clock source supports (RANGE request)
+// The reply is a subrange count followed by MIN/MAX/RES triplets. Each
+// candidate rate is checked against every subrange. Returns the number of
+// rates stored, or 0 if the clock didn't answer.
+static int katana_uac2_read_rates(struct katana_pcm_data *data, const unsigned int *candidates,
+				  int count, unsigned int *rates)
+{
+	int size = 2 + KATANA_UAC2_MAX_SUBRANGES * 12;
+	unsigned char *buf;
+	int subranges;
+	int found = 0;
+	int err;
+	int i, k;
+	
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return 0;
+	
+	err = usb_control_msg(data->usb_dev,
+			      usb_rcvctrlpipe(data->usb_dev, 0),
+			      KATANA_UAC2_RANGE,
+			      0xa1,
+			      KATANA_UAC2_SAM_FREQ << 8,
+			      (data->clock_id << 8) | AUDIO_CONTROL_IFACE_ID,
+			      buf,
+			      size,
+			      1000);
+	if (err < 2) {
+		pr_debug("Katana PCM: Clock %u RANGE request failed: %d\n", data->clock_id, err);
+		kfree(buf);
+		return 0;
+	}
+	
+	subranges = min_t(int, get_unaligned_le16(buf), (err - 2) / 12);
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < subranges; k++) {
+			unsigned char *r = buf + 2 + k * 12;
+			unsigned int min = get_unaligned_le32(r);
+			unsigned int max = get_unaligned_le32(r + 4);
+			unsigned int res = get_unaligned_le32(r + 8);
+			
+			if (candidates[i] < min || candidates[i] > max)
+				continue;
+			if (res && (candidates[i] - min) % res)
+				continue;
+			rates[found++] = candidates[i];
+			break;
+		}
+	}
+	
+	kfree(buf);
+	return found;
+}
+
 // Set sample rate using USB Audio Class control requests
 static int katana_set_sample_rate(struct katana_pcm_data *data, unsigned int rate)
 {
 	int err;
 	unsigned char rate_data[3];
 	
+	if (data->uac2)
+		return katana_uac2_set_rate(data, rate);
+	
 	// Pack sample rate into 3-byte little-endian format
 	rate_data[0] = rate & 0xff;
 	rate_data[1] = (rate >> 8) & 0xff;
@@ -265,11 +678,839 @@ static int katana_set_sample_rate(struct katana_pcm_data *data, unsigned int rat
 	return 0;
 }
 
+// Offer the rates the UAC2 clock supports, and the resampled 44.1kHz family
+// rate next to each 48kHz family one unless the clock has its own. UAC2
+// format descriptors carry no rates, so this replaces katana_device_has_44k().
+static void katana_uac2_setup_rates(struct katana_pcm_data *data, struct snd_pcm_runtime *runtime)
+{
+	static const unsigned int candidates[] = { 44100, 48000, 88200, 96000, 176400, 192000 };
+	unsigned int native[ARRAY_SIZE(candidates)];
+	int count = 0;
+	int n = 0;
+	int i;
+	
+	if (!(katana_quirks & KATANA_QUIRK_NO_RATE_RANGE))
+		n = katana_uac2_read_rates(data, candidates, ARRAY_SIZE(candidates), native);
+	if (!n) {
+		// Every Katana runs at 48kHz and 96kHz
+		native[n++] = 48000;
+		native[n++] = 96000;
+	}
+	
+	data->native_44k = 0;
+	for (i = 0; i < n; i++) {
+		if (native[i] % 44100 == 0)
+			data->native_44k = 1;
+	}
+	
+	for (i = 0; i < n; i++) {
+		if (resample && !data->native_44k)
+			data->rate_list[count++] = native[i] / KATANA_RS_PHASES * KATANA_RS_STEP;
+		data->rate_list[count++] = native[i];
+	}
+	
+	data->rate_constraints.count = count;
+	data->rate_constraints.list = data->rate_list;
+	data->rate_constraints.mask = 0;
+	
+	runtime->hw.rates = SNDRV_PCM_RATE_KNOT;
+	runtime->hw.rate_min = data->rate_list[0];
+	runtime->hw.rate_max = data->rate_list[count - 1];
+	snd_pcm_hw_constraint_list(runtime, 0, SNDRV_PCM_HW_PARAM_RATE, &data->rate_constraints);
+}
+
+// Check whether any streaming altsetting's format descriptor lists a rate
+// in the 44.1kHz family (UAC1 Type I, discrete or continuous)
+static int katana_device_has_44k(struct katana_pcm_data *data)
+{
+	struct usb_interface *iface = data->usb_iface;
+	int i;
+	
+	for (i = 0; i < iface->num_altsetting; i++) {
+		unsigned char *p = iface->altsetting[i].extra;
+		int left = iface->altsetting[i].extralen;
+		
+		for (; left >= 2 && p[0] >= 2 && p[0] <= left; left -= p[0], p += p[0]) {
+			unsigned int n, k;
+			
+			// CS_INTERFACE, FORMAT_TYPE, FORMAT_TYPE_I
+			if (p[0] < 8 || p[1] != 0x24 || p[2] != 0x02 || p[3] != 0x01)
+				continue;
+			
+			n = p[7] ? p[7] : 2; // 0 means a continuous lower/upper pair
+			if (8 + n * 3 > p[0])
+				continue;
+			
+			for (k = 0; k < n; k++) {
+				unsigned int freq = p[8 + k * 3] | (p[9 + k * 3] << 8) | (p[10 + k * 3] << 16);
+				
+				if (freq == 44100 || freq == 88200)
+					return 1;
+			}
+			if (!p[7]) {
+				unsigned int lo = p[8] | (p[9] << 8) | (p[10] << 16);
+				unsigned int hi = p[11] | (p[12] << 8) | (p[13] << 16);
+				
+				if (lo <= 44100 && hi >= 44100)
+					return 1;
+			}
+		}
+	}
+	
+	return 0;
+}
+
 // Forward declarations for URB functions
 static int katana_alloc_urb_buffers(struct katana_pcm_data *data);
 static void katana_free_urb_buffers(struct katana_pcm_data *data);
 static void katana_urb_complete(struct urb *urb);
 static void katana_sync_urb_complete(struct urb *urb);
+static void katana_fill_work(struct kthread_work *work);
+static void katana_idle_timer(struct timer_list *t);
+
+// Find the slot of a data URB in the streaming ring
+static int katana_urb_index(struct katana_pcm_data *data, struct urb *urb)
+{
+	int i;
+
+	for (i = 0; i < data->num_urbs; i++) {
+		if (data->urbs[i] == urb)
+			return i;
+	}
+	return -1;
+}
+
+// Track a URB as in flight before it's handed to the USB core (caller holds data->lock)
+// Claiming first means a completion can never race ahead of the bookkeeping,
+// and the submission itself can happen after the lock is dropped.
+static void katana_claim_urb_locked(struct katana_pcm_data *data, struct urb *urb)
+{
+	int idx;
+
+	if (urb == data->sync_urb) {
+		data->sync_in_flight = 1;
+	} else {
+		idx = katana_urb_index(data, urb);
+		if (idx >= 0)
+			__set_bit(idx, &data->urbs_in_flight);
+	}
+}
+
+// Mark a URB as handed back by the USB core (caller holds data->lock)
+// Once the last one retires, a pending .sync_stop is released.
+static void katana_retire_urb_locked(struct katana_pcm_data *data, struct urb *urb)
+{
+	int idx;
+
+	if (urb == data->sync_urb) {
+		data->sync_in_flight = 0;
+	} else {
+		idx = katana_urb_index(data, urb);
+		if (idx >= 0)
+			__clear_bit(idx, &data->urbs_in_flight);
+	}
+
+	if (!data->urbs_in_flight && !data->sync_in_flight) {
+		data->stopping = 0;
+		wake_up(&data->stop_wait);
+	}
+}
+
+// Submit a claimed URB (called without data->lock)
+// If the USB core refuses it, the claim is dropped again.
+static int katana_submit_claimed_urb(struct katana_pcm_data *data, struct urb *urb)
+{
+	unsigned long flags;
+	int err;
+
+	err = usb_submit_urb(urb, GFP_ATOMIC);
+	if (err < 0) {
+		raw_spin_lock_irqsave(&data->lock, flags);
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+	}
+	return err;
+}
+
+// Check whether every URB has been retired
+static int katana_urbs_retired(struct katana_pcm_data *data)
+{
+	unsigned long flags;
+	int retired;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	retired = !data->urbs_in_flight && !data->sync_in_flight;
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+	return retired;
+}
+
+// Frames the application has written that no URB has taken yet (lock held)
+// Computed in boundary space so a completely full buffer isn't mistaken for
+// an empty one.
+static unsigned int katana_pending_frames(struct katana_pcm_data *data)
+{
+	struct snd_pcm_runtime *runtime = data->substream->runtime;
+	snd_pcm_sframes_t pending;
+
+	pending = READ_ONCE(runtime->control->appl_ptr) - data->read_abs;
+	if (pending < 0)
+		pending += runtime->boundary;
+	return min_t(snd_pcm_uframes_t, pending, data->buffer_size);
+}
+
+// Hand frames from the PCM buffer over to a URB (lock held)
+static void katana_advance_read_ptr(struct katana_pcm_data *data, unsigned int frames)
+{
+	struct snd_pcm_runtime *runtime = data->substream->runtime;
+
+	data->read_ptr = (data->read_ptr + frames) % data->buffer_size;
+	data->read_abs += frames;
+	if (data->read_abs >= runtime->boundary)
+		data->read_abs -= runtime->boundary;
+}
+
+// Check whether frames in the PCM buffer are all digital silence
+// Called without data->lock: frames the application has written stay put
+// until a URB or the idle timer has consumed them.
+static int katana_frames_silent(struct katana_pcm_data *data, unsigned int start, unsigned int frames)
+{
+	unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
+	const char *pcm_buffer = data->substream->runtime->dma_area;
+	unsigned int first = min(frames, data->buffer_size - start);
+
+	if (memchr_inv(pcm_buffer + start * frame_size, 0, first * frame_size))
+		return 0;
+	return !memchr_inv(pcm_buffer, 0, (frames - first) * frame_size);
+}
+
+// Count the silent frames a URB just took and go idle once idle_silence_ms
+// worth went out in a row (called without data->lock). The URBs in flight
+// are retired as they complete, then the idle timer takes over.
+static void katana_track_silence(struct katana_pcm_data *data, unsigned int start, unsigned int frames)
+{
+	unsigned int limit = READ_ONCE(idle_silence_ms);
+	unsigned long flags;
+	int silent;
+	int go_idle = 0;
+
+	// An underrun says nothing about the content either way
+	if (!limit || !frames)
+		return;
+
+	silent = katana_frames_silent(data, start, frames);
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	if (!silent) {
+		data->silent_frames = 0;
+	} else if (!data->idle) {
+		data->silent_frames += frames;
+		if (data->running && data->silent_frames / (data->rate / 1000) >= limit) {
+			data->idle = 1;
+			data->idle_start = 0;
+			katana_stats.idle_entries++;
+			go_idle = 1;
+		}
+	}
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	if (go_idle) {
+		mod_timer(&data->idle_timer, jiffies + msecs_to_jiffies(KATANA_IDLE_TICK_MS));
+		schedule_work(&data->qos_work);
+	}
+}
+
+// Remember the device table quirks of the bound device (probe)
+void katana_pcm_set_quirks(unsigned long quirks)
+{
+	katana_quirks = quirks;
+}
+
+// Set the digital trim gain (Q2.30) the fill path applies
+void katana_pcm_set_trim_gain(u32 gain)
+{
+	WRITE_ONCE(katana_trim_gain, gain);
+}
+
+// Scale one 24-bit sample by the digital trim and store it as S24_3LE.
+// Non-unity gains are dithered (TPDF, +-1 LSB) before rounding.
+static inline void katana_store_sample(unsigned char *dest, s32 sample, u32 gain,
+				       u32 *seed, bool add_dither)
+{
+	s64 acc = sample;
+
+	if (gain != KATANA_GAIN_UNITY) {
+		acc = acc * gain + (1 << 29);
+		if (add_dither) {
+			// Sum of two 16-bit uniforms is triangular over +-1 LSB
+			*seed ^= *seed << 13;
+			*seed ^= *seed >> 17;
+			*seed ^= *seed << 5;
+			acc += ((s64)(*seed & 0xffff) + (*seed >> 16) - 0xffff) << 14;
+		}
+		acc >>= 30;
+	}
+
+	if (acc > 0x7fffff)
+		acc = 0x7fffff;
+	else if (acc < -0x800000)
+		acc = -0x800000;
+
+	dest[0] = acc & 0xff;
+	dest[1] = (acc >> 8) & 0xff;
+	dest[2] = (acc >> 16) & 0xff;
+}
+
+static inline s32 katana_load_sample(const unsigned char *src)
+{
+	return (s32)((u32)src[0] << 8 | (u32)src[1] << 16 | (u32)src[2] << 24) >> 8;
+}
+
+// Copy S24_3LE samples into a URB buffer, applying the digital trim.
+// At unity gain this is a plain memcpy and the stream stays bit-exact.
+// Otherwise each sample is unpacked, scaled, dithered, rounded, clamped
+// and repacked in the same pass over the data.
+static void katana_copy_samples(struct katana_pcm_data *data, unsigned char *dest,
+				const unsigned char *src, unsigned int bytes, u32 gain)
+{
+	u32 seed = data->dither_seed;
+	bool add_dither = READ_ONCE(dither);
+
+	if (gain == KATANA_GAIN_UNITY) {
+		memcpy(dest, src, bytes);
+		return;
+	}
+
+	for (; bytes >= 3; bytes -= 3, src += 3, dest += 3)
+		katana_store_sample(dest, katana_load_sample(src), gain, &seed, add_dither);
+
+	data->dither_seed = seed;
+}
+
+// Publish the meter values of the period just completed and reset the
+// accumulators. Mixer clients are notified when something changed.
+static void katana_meter_publish(struct katana_pcm_data *data)
+{
+	u32 rms[KATANA_METER_CHANNELS];
+	unsigned long flags;
+	int changed = 0;
+	int ch;
+
+	for (ch = 0; ch < KATANA_METER_CHANNELS; ch++)
+		rms[ch] = data->meter_frames ?
+			  int_sqrt64(div_u64(data->meter_sum[ch], data->meter_frames)) : 0;
+
+	raw_spin_lock_irqsave(&katana_meter_lock, flags);
+	for (ch = 0; ch < KATANA_METER_CHANNELS; ch++) {
+		if (katana_meter_peak[ch] != data->meter_peak[ch] || katana_meter_rms[ch] != rms[ch])
+			changed = 1;
+		katana_meter_peak[ch] = data->meter_peak[ch];
+		katana_meter_rms[ch] = rms[ch];
+	}
+	raw_spin_unlock_irqrestore(&katana_meter_lock, flags);
+
+	memset(data->meter_peak, 0, sizeof(data->meter_peak));
+	memset(data->meter_sum, 0, sizeof(data->meter_sum));
+	data->meter_frames = 0;
+
+	if (changed)
+		katana_control_meter_changed(0);
+}
+
+// Fold stereo S24_3LE frames just written to a URB into the level meters
+// This pass runs over data the copy has just brought into cache, so the
+// cost is small next to the copy.
+static void katana_meter_frames(struct katana_pcm_data *data, const unsigned char *buf,
+				unsigned int frames)
+{
+	u32 peak0 = data->meter_peak[0], peak1 = data->meter_peak[1];
+	u64 sum0 = data->meter_sum[0], sum1 = data->meter_sum[1];
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, buf += 6) {
+		s32 l = katana_load_sample(buf);
+		s32 r = katana_load_sample(buf + 3);
+
+		peak0 = max_t(u32, peak0, abs(l));
+		peak1 = max_t(u32, peak1, abs(r));
+		sum0 += (s64)l * l;
+		sum1 += (s64)r * r;
+	}
+
+	data->meter_peak[0] = peak0;
+	data->meter_peak[1] = peak1;
+	data->meter_sum[0] = sum0;
+	data->meter_sum[1] = sum1;
+	data->meter_frames += frames;
+	if (data->meter_frames >= data->period_size)
+		katana_meter_publish(data);
+}
+
+// Read the published meter values (meter controls)
+void katana_pcm_get_meters(u32 *peak, u32 *rms)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&katana_meter_lock, flags);
+	memcpy(peak, katana_meter_peak, sizeof(katana_meter_peak));
+	memcpy(rms, katana_meter_rms, sizeof(katana_meter_rms));
+	raw_spin_unlock_irqrestore(&katana_meter_lock, flags);
+}
+
+// Step the PRBS register once and return its low 24 bits as a sample
+static inline s32 katana_test_prbs(u32 *lfsr)
+{
+	*lfsr = (*lfsr >> 1) ^ (-(*lfsr & 1) & KATANA_TEST_PRBS_TAPS);
+	return (s32)(*lfsr << 8) >> 8;
+}
+
+// Generate frames of the selected test signal into a URB buffer
+// No trim or dither: the samples on the wire are exactly the pattern.
+static void katana_test_generate(struct katana_pcm_data *data, int signal,
+				 unsigned char *dest, unsigned int frames)
+{
+	unsigned int period = max(data->dev_rate / KATANA_TEST_SINE_HZ, 1U);
+	unsigned int i;
+	s32 l, r;
+
+	for (i = 0; i < frames; i++, dest += 6, data->test_count++) {
+		switch (signal) {
+		case KATANA_TEST_COUNTER:
+			l = (s32)(data->test_count << 8) >> 8;
+			r = ~l;
+			break;
+		case KATANA_TEST_SINE:
+			l = fixp_sin32_rad(data->test_count % period, period) >> 9;
+			r = l;
+			break;
+		default:
+			l = katana_test_prbs(&data->test_lfsr);
+			r = katana_test_prbs(&data->test_lfsr);
+			break;
+		}
+		katana_store_sample(dest, l, KATANA_GAIN_UNITY, NULL, false);
+		katana_store_sample(dest + 3, r, KATANA_GAIN_UNITY, NULL, false);
+	}
+}
+
+// Build the resampler filter bank: Catmull-Rom cubic taps for each of the
+// KATANA_RS_PHASES output positions, in Q14. Integer only, no FPU.
+static void katana_rs_init_coefs(void)
+{
+	const s64 n = KATANA_RS_PHASES;
+	const s64 den = 2 * n * n * n;
+	int p;
+	
+	for (p = 0; p < KATANA_RS_PHASES; p++) {
+		s64 t1 = p, t2 = t1 * p, t3 = t2 * p;
+		s32 c0 = div_s64((-t3 + 2 * n * t2 - n * n * t1) * (1 << 14), den);
+		s32 c2 = div_s64((-3 * t3 + 4 * n * t2 + n * n * t1) * (1 << 14), den);
+		s32 c3 = div_s64((t3 - n * t2) * (1 << 14), den);
+		
+		katana_rs_coef[p][0] = c0;
+		katana_rs_coef[p][1] = (1 << 14) - c0 - c2 - c3; // Taps sum to exactly 1.0
+		katana_rs_coef[p][2] = c2;
+		katana_rs_coef[p][3] = c3;
+	}
+}
+
+// Source frames consumed when producing out_frames from the given phase
+static inline unsigned int katana_rs_src_frames(unsigned int phase, unsigned int out_frames)
+{
+	return (phase + out_frames * KATANA_RS_STEP) / KATANA_RS_PHASES;
+}
+
+// Most output frames that can be produced without using more than
+// src_frames source frames
+static inline unsigned int katana_rs_max_out(unsigned int phase, unsigned int src_frames)
+{
+	return ((src_frames + 1) * KATANA_RS_PHASES - 1 - phase) / KATANA_RS_STEP;
+}
+
+// Resample out_frames stereo frames into dest, pulling source frames from
+// the PCM ring starting at *src_frame (advanced as they're used). The trim
+// is applied to each output sample on the way out.
+static void katana_resample_frames(struct katana_pcm_data *data, unsigned char *dest,
+				   unsigned int out_frames, unsigned int *src_frame, u32 gain)
+{
+	const unsigned char *pcm_buffer = data->substream->runtime->dma_area;
+	unsigned int phase = data->rs_phase;
+	u32 seed = data->dither_seed;
+	bool add_dither = READ_ONCE(dither);
+	unsigned int i;
+	int ch;
+	
+	for (i = 0; i < out_frames; i++, dest += 6) {
+		const s16 *c = katana_rs_coef[phase];
+		
+		for (ch = 0; ch < 2; ch++) {
+			s64 acc = (s64)c[0] * data->rs_hist[0][ch] +
+				  (s64)c[1] * data->rs_hist[1][ch] +
+				  (s64)c[2] * data->rs_hist[2][ch] +
+				  (s64)c[3] * data->rs_hist[3][ch];
+			
+			katana_store_sample(dest + ch * 3, (s32)((acc + (1 << 13)) >> 14),
+					    gain, &seed, add_dither);
+		}
+		
+		// Shift in every source frame the next output position passes
+		for (phase += KATANA_RS_STEP; phase >= KATANA_RS_PHASES; phase -= KATANA_RS_PHASES) {
+			const unsigned char *src = pcm_buffer + *src_frame * 6;
+			
+			memmove(data->rs_hist[0], data->rs_hist[1], sizeof(data->rs_hist[0]) * 3);
+			data->rs_hist[3][0] = katana_load_sample(src);
+			data->rs_hist[3][1] = katana_load_sample(src + 3);
+			*src_frame = (*src_frame + 1) % data->buffer_size;
+		}
+	}
+	
+	data->rs_phase = phase;
+	data->dither_seed = seed;
+}
+
+// Reserve PCM frames for a URB filled by the test signal (lock held)
+// Test signals fill every packet. The application's frames are still
+// consumed at the rate the wire would have taken them, so the pointer
+// logic runs as usual and an application that falls behind only shows in
+// the pointers, not on the wire.
+static unsigned int katana_test_consume_locked(struct katana_pcm_data *data, unsigned int out_frames,
+					       unsigned int available_frames)
+{
+	unsigned int src_frames = out_frames;
+
+	if (data->resampling) {
+		src_frames = katana_rs_src_frames(data->rs_phase, out_frames);
+		data->rs_phase = (data->rs_phase + out_frames * KATANA_RS_STEP) % KATANA_RS_PHASES;
+	}
+	katana_stats.test_frames += out_frames;
+	return min(src_frames, available_frames);
+}
+
+// Fill a data URB from the PCM buffer (called without data->lock)
+// The frames are reserved under the lock, then copied after it is dropped;
+// the reserved region sits between hw_ptr and read_ptr, so the application
+// can't overwrite it meanwhile. Packets the application hasn't provided data
+// for are padded with silence.
+// Returns the number of silence frames sent, or a negative error if the
+// stream has stopped (the URB is retired in that case).
+static int katana_fill_urb(struct katana_pcm_data *data, struct urb *urb, int idx)
+{
+	struct snd_pcm_substream *substream = data->substream;
+	unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
+	char *pcm_buffer = substream->runtime->dma_area;
+	unsigned char *urb_buffer = data->urb_buffers[idx];
+	unsigned long flags;
+	u32 rate_q16;
+	unsigned int available_frames;
+	unsigned int read_start;
+	unsigned int copy_offset;
+	unsigned int src_start;
+	unsigned int src_frames;
+	unsigned int silence_frames = 0;
+	u32 gain = READ_ONCE(katana_trim_gain);
+	int signal = READ_ONCE(katana_test_signal);
+	int k;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+
+	if (!data->stream_started || !data->running) {
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return -ESHUTDOWN;
+	}
+	
+	// Samples per packet in Q16, from feedback data when there is some
+	if (data->feedback_valid && data->feedback_q16 > 0) {
+		rate_q16 = data->feedback_q16;
+	} else {
+		// Fallback to nominal rate-based calculation
+		rate_q16 = div_u64((u64)data->dev_rate << 16, data->packets_per_sec);
+	}
+	
+	// Calculate available data in PCM buffer
+	available_frames = pcm_buffer ? katana_pending_frames(data) : 0;
+	read_start = data->read_ptr;
+	src_start = read_start;
+	
+	if (usb_pipeisoc(urb->pipe)) {
+		// Handle isochronous transfer with multiple packets
+		unsigned int total_samples_needed = 0;
+		unsigned int samples_copied = 0;
+		unsigned int offset = 0;
+		
+		// Size the packets from the current feedback. The fractional part
+		// is carried over, so e.g. 44.1 samples per packet goes out as
+		// nine packets of 44 and one of 45.
+		for (k = 0; k < urb->number_of_packets; k++) {
+			unsigned int this_packet_samples;
+			
+			data->packet_phase += rate_q16;
+			this_packet_samples = min(data->packet_phase >> 16, data->packet_max_frames);
+			data->packet_phase &= 0xffff;
+			
+			urb->iso_frame_desc[k].offset = offset;
+			urb->iso_frame_desc[k].length = this_packet_samples * frame_size;
+			offset += urb->iso_frame_desc[k].length;
+			total_samples_needed += this_packet_samples;
+		}
+		
+		// Limit to available data
+		if (signal) {
+			src_frames = katana_test_consume_locked(data, total_samples_needed, available_frames);
+		} else if (data->resampling) {
+			// Packets carry device frames; limit by the source they need
+			unsigned int max_out = katana_rs_max_out(data->rs_phase, available_frames);
+			
+			if (total_samples_needed > max_out) {
+				silence_frames = total_samples_needed - max_out;
+				total_samples_needed = max_out;
+			}
+			src_frames = katana_rs_src_frames(data->rs_phase, total_samples_needed);
+		} else {
+			if (total_samples_needed > available_frames) {
+				silence_frames = total_samples_needed - available_frames;
+				total_samples_needed = available_frames;
+			}
+			src_frames = total_samples_needed;
+		}
+		
+		// Reserve the frames for this URB
+		katana_advance_read_ptr(data, src_frames);
+		data->urb_src_frames[idx] = src_frames;
+		data->urb_fill_feedback[idx] = data->feedback_value;
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		
+		// Fill URB buffer with audio data, then silence for the rest
+		for (k = 0; k < urb->number_of_packets; k++) {
+			unsigned int packet_samples = urb->iso_frame_desc[k].length / frame_size;
+			unsigned int samples_to_copy = min(packet_samples, total_samples_needed - samples_copied);
+			unsigned int copy_size = samples_to_copy * frame_size;
+			unsigned char *dest = urb_buffer + urb->iso_frame_desc[k].offset;
+			
+			if (copy_size > 0 && signal) {
+				katana_test_generate(data, signal, dest, samples_to_copy);
+				katana_meter_frames(data, dest, samples_to_copy);
+				samples_copied += samples_to_copy;
+			} else if (copy_size > 0 && data->resampling) {
+				katana_resample_frames(data, dest, samples_to_copy, &read_start, gain);
+				katana_meter_frames(data, dest, samples_to_copy);
+				samples_copied += samples_to_copy;
+			} else if (copy_size > 0) {
+				// Calculate source offset in PCM buffer
+				copy_offset = ((read_start + samples_copied) % data->buffer_size) * frame_size;
+				
+				if (copy_offset + copy_size <= substream->runtime->dma_bytes) {
+					katana_copy_samples(data, dest, pcm_buffer + copy_offset, copy_size, gain);
+				} else {
+					// Handle wraparound
+					unsigned int first_part = substream->runtime->dma_bytes - copy_offset;
+					unsigned int second_part = copy_size - first_part;
+					katana_copy_samples(data, dest, pcm_buffer + copy_offset, first_part, gain);
+					katana_copy_samples(data, dest + first_part, pcm_buffer, second_part, gain);
+				}
+				katana_meter_frames(data, dest, samples_to_copy);
+				samples_copied += samples_to_copy;
+			}
+			
+			// Don't send stale audio from the previous round in short packets
+			if (copy_size < urb->iso_frame_desc[k].length) {
+				memset(dest + copy_size, 0, urb->iso_frame_desc[k].length - copy_size);
+			}
+		}
+	} else {
+		// Handle bulk transfer (fallback for non-isochronous endpoints)
+		unsigned int samples_needed = data->urb_buffer_size / frame_size;
+		
+		if (signal) {
+			src_frames = katana_test_consume_locked(data, samples_needed, available_frames);
+		} else if (data->resampling) {
+			samples_needed = min(samples_needed, katana_rs_max_out(data->rs_phase, available_frames));
+			src_frames = katana_rs_src_frames(data->rs_phase, samples_needed);
+		} else {
+			if (samples_needed > available_frames) {
+				samples_needed = available_frames;
+			}
+			src_frames = samples_needed;
+		}
+		
+		// Reserve the frames for this URB
+		katana_advance_read_ptr(data, src_frames);
+		data->urb_src_frames[idx] = src_frames;
+		data->urb_fill_feedback[idx] = data->feedback_value;
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		
+		if (samples_needed > 0) {
+			unsigned int copy_size = samples_needed * frame_size;
+			copy_offset = read_start * frame_size;
+			
+			if (signal) {
+				katana_test_generate(data, signal, urb->transfer_buffer, samples_needed);
+			} else if (data->resampling) {
+				katana_resample_frames(data, urb->transfer_buffer, samples_needed, &read_start, gain);
+			} else if (copy_offset + copy_size <= substream->runtime->dma_bytes) {
+				katana_copy_samples(data, urb->transfer_buffer, pcm_buffer + copy_offset, copy_size, gain);
+			} else {
+				// Handle wraparound
+				unsigned int first_part = substream->runtime->dma_bytes - copy_offset;
+				unsigned int second_part = copy_size - first_part;
+				katana_copy_samples(data, urb->transfer_buffer, pcm_buffer + copy_offset, first_part, gain);
+				katana_copy_samples(data, (unsigned char *)urb->transfer_buffer + first_part, pcm_buffer, second_part, gain);
+			}
+			katana_meter_frames(data, urb->transfer_buffer, samples_needed);
+			
+			urb->transfer_buffer_length = copy_size;
+		} else {
+			// Fill with silence
+			memset(urb->transfer_buffer, 0, data->urb_buffer_size);
+			urb->transfer_buffer_length = data->urb_buffer_size;
+			silence_frames = data->urb_buffer_size / frame_size;
+		}
+	}
+	
+	// A test signal is never silent, whatever the application writes
+	if (!signal)
+		katana_track_silence(data, src_start, src_frames);
+	
+	data->urb_silence_frames[idx] = silence_frames;
+	return silence_frames;
+}
+
+// Update the adaptive depth controller after a data URB completed (lock held)
+// A completion that arrives later than half the time covered by the URBs
+// still queued is a near miss and grows the depth at once. Shrinking needs
+// several calm windows in a row, with the worst jitter and the application
+// margin both leaving room for one URB less.
+static void katana_adapt_depth(struct katana_pcm_data *data)
+{
+	unsigned int in_flight = hweight_long(data->urbs_in_flight);
+	unsigned int urb_frames = data->rate / data->packets_per_sec * KATANA_PACKETS_PER_URB;
+	unsigned int deviation_us = 0;
+	unsigned int budget_us;
+	unsigned int margin;
+	ktime_t now = ktime_get();
+
+	if (data->last_complete) {
+		int interval_us = ktime_us_delta(now, data->last_complete);
+		deviation_us = abs(interval_us - (int)data->urb_period_us);
+	}
+	data->last_complete = now;
+
+	// Time covered by the URBs queued behind this one
+	budget_us = (in_flight - 1) * data->urb_period_us;
+
+	if (deviation_us > budget_us / 2) {
+		if (data->target_urbs < data->num_urbs) {
+			data->target_urbs++;
+			katana_stats.depth_grows++;
+			schedule_work(&data->qos_work);
+		}
+		data->window_jitter_us = 0;
+		data->window_margin = UINT_MAX;
+		data->window_count = 0;
+		data->calm_windows = 0;
+		katana_stats.urb_depth = data->target_urbs;
+		return;
+	}
+
+	margin = katana_pending_frames(data);
+	data->window_jitter_us = max(data->window_jitter_us, deviation_us);
+	data->window_margin = min(data->window_margin, margin);
+	if (++data->window_count < KATANA_ADAPT_WINDOW)
+		return;
+
+	// Would one URB less still leave twice the worst jitter as headroom?
+	if (data->target_urbs > KATANA_MIN_URBS &&
+	    data->window_jitter_us * 2 < (data->target_urbs - 2) * data->urb_period_us &&
+	    data->window_margin >= urb_frames) {
+		data->calm_windows++;
+	} else {
+		data->calm_windows = 0;
+	}
+
+	if (data->calm_windows >= KATANA_ADAPT_CALM_WINDOWS) {
+		data->target_urbs--;
+		data->calm_windows = 0;
+		katana_stats.depth_shrinks++;
+		schedule_work(&data->qos_work);
+	}
+
+	katana_stats.jitter_us = data->window_jitter_us;
+	katana_stats.urb_depth = data->target_urbs;
+	data->window_jitter_us = 0;
+	data->window_margin = UINT_MAX;
+	data->window_count = 0;
+}
+
+// Claim one parked URB to follow the ones in flight (lock held)
+// Returns its slot, or -1 if the whole ring is already in use.
+static int katana_claim_idle_urb_locked(struct katana_pcm_data *data)
+{
+	int idx = find_first_zero_bit(&data->urbs_in_flight, data->num_urbs);
+
+	if (idx >= data->num_urbs)
+		return -1;
+
+	katana_claim_urb_locked(data, data->urbs[idx]);
+	return idx;
+}
+
+// Claim the sync URB and every parked data URB to (re)start streaming (lock held)
+// URBs still draining from a previous STOP retire on their own; only the
+// ones already handed back are reused. Returns the data URBs to submit.
+static unsigned long katana_claim_ring_locked(struct katana_pcm_data *data, int *submit_sync)
+{
+	unsigned long submit_mask = 0;
+	int i;
+
+	*submit_sync = 0;
+	if (!data->sync_in_flight) {
+		katana_claim_urb_locked(data, data->sync_urb);
+		*submit_sync = 1;
+	}
+	for (i = 0; i < data->num_urbs; i++) {
+		if (test_bit(i, &data->urbs_in_flight))
+			continue;
+		katana_claim_urb_locked(data, data->urbs[i]);
+		data->urb_src_frames[i] = 0;
+		__set_bit(i, &submit_mask);
+	}
+	return submit_mask;
+}
+
+// Check that a completed isochronous URB started where the previous one ended,
+// and account for frames the host controller skipped or dropped (lock held).
+// Returns non-zero when stream continuity was broken.
+static int katana_check_continuity(struct katana_pcm_data *data, struct urb *urb)
+{
+	unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
+	unsigned int gap;
+	int broken = 0;
+	int k;
+
+	// High speed start frames count frames or microframes depending on the
+	// host controller, so only dropped packets are detected there
+	if (data->next_frame_valid && !data->high_speed) {
+		gap = (urb->start_frame - data->next_frame) & KATANA_FRAME_MASK;
+		// A "negative" gap means the URB was rescheduled earlier; just resync
+		if (gap && gap < KATANA_FRAME_MASK / 2) {
+			katana_stats.schedule_gaps++;
+			katana_stats.frames_skipped += gap;
+			broken = 1;
+		}
+	}
+	data->next_frame = (urb->start_frame + urb->number_of_packets * urb->interval) & KATANA_FRAME_MASK;
+	data->next_frame_valid = 1;
+
+	// Late packets are completed with -EXDEV and never reach the device
+	for (k = 0; k < urb->number_of_packets; k++) {
+		if (urb->iso_frame_desc[k].status) {
+			katana_stats.packets_dropped++;
+			katana_stats.frames_dropped += urb->iso_frame_desc[k].length / frame_size;
+			broken = 1;
+		}
+	}
+
+	return broken;
+}
 
 // PCM operations structure
 struct snd_pcm_ops katana_pcm_playback_ops = {
@@ -280,6 +1521,7 @@ struct snd_pcm_ops katana_pcm_playback_ops = {
 	.hw_free = katana_pcm_hw_free,
 	.prepare = katana_pcm_prepare,
 	.trigger = katana_pcm_trigger,
+	.sync_stop = katana_pcm_sync_stop,
 	.pointer = katana_pcm_pointer,
 };
 
@@ -294,9 +1536,12 @@ int katana_pcm_new(struct snd_card *card, struct snd_pcm **pcm_ret)
 		return err;
 
 	snd_pcm_set_ops(pcm, SNDRV_PCM_STREAM_PLAYBACK, &katana_pcm_playback_ops);
+	katana_pcm = pcm;
 	pcm->private_data = card;
 	pcm->info_flags = 0;
 	strcpy(pcm->name, "SoundBlaster X Katana");
+	
+	katana_rs_init_coefs();
 
 	// Set up DMA buffer management for ALSA PCM layer
 	// We use vmalloc-backed memory for the PCM buffer since we'll
@@ -310,6 +1555,485 @@ int katana_pcm_new(struct snd_card *card, struct snd_pcm **pcm_ret)
 	return 0;
 }
 
+// Append one record to the telemetry ring. Lock-free: data and feedback
+// completions may run concurrently, so each claims its own slot.
+static void katana_telemetry_log(u8 type, struct urb *urb, u8 slot, u32 frames,
+				 u32 silence_frames, u32 feedback, s32 appl_margin)
+{
+	struct katana_telemetry_header *hdr = katana_telemetry;
+	struct katana_telemetry_record *rec;
+	u64 n;
+
+	if (!hdr)
+		return;
+
+	n = atomic64_inc_return(&katana_telemetry_head) - 1;
+	rec = (struct katana_telemetry_record *)(hdr + 1) + (n % KATANA_TELEMETRY_RECORDS);
+
+	WRITE_ONCE(rec->seq, (u32)(2 * n + 1));
+	smp_wmb();
+	rec->timestamp_ns = ktime_get_ns();
+	rec->type = type;
+	rec->urb = slot;
+	rec->status = urb->status;
+	rec->start_frame = urb->start_frame;
+	rec->frames = frames;
+	rec->silence_frames = silence_frames;
+	rec->feedback = feedback;
+	rec->appl_margin = appl_margin;
+	smp_wmb();
+	WRITE_ONCE(rec->seq, (u32)(2 * n + 2));
+	WRITE_ONCE(hdr->head, atomic64_read(&katana_telemetry_head));
+
+	if (wq_has_sleeper(&katana_telemetry_wait))
+		wake_up_interruptible(&katana_telemetry_wait);
+}
+
+// Record a completed data URB in the wire tap (called without data->lock)
+// The packets are copied once, from the URB buffer straight into the
+// reserved relay sub-buffer space. The buffer isn't refilled before this
+// returns.
+static void katana_tap_record(struct katana_pcm_data *data, struct urb *urb, int idx)
+{
+	struct katana_tap_record *rec;
+	unsigned int nr_packets = usb_pipeisoc(urb->pipe) ? urb->number_of_packets : 0;
+	unsigned int payload = 0;
+	unsigned int size;
+	unsigned long flags;
+	unsigned char *p;
+	int k;
+
+	if (!READ_ONCE(katana_tap_on))
+		return;
+
+	if (nr_packets) {
+		for (k = 0; k < nr_packets; k++)
+			payload += urb->iso_frame_desc[k].length;
+	} else {
+		payload = urb->transfer_buffer_length;
+	}
+	size = ALIGN(sizeof(*rec) + nr_packets * sizeof(__u16) + payload, 8);
+
+	raw_spin_lock_irqsave(&katana_tap_lock, flags);
+	if (!katana_tap_on)
+		goto out;
+
+	rec = relay_reserve(katana_tap_chan, size);
+	if (!rec) {
+		katana_stats.tap_dropped++;
+		goto out;
+	}
+
+	rec->magic = KATANA_TAP_MAGIC;
+	rec->size = size;
+	rec->timestamp_ns = ktime_get_ns();
+	rec->seq = katana_tap_seq++;
+	rec->status = urb->status;
+	rec->start_frame = urb->start_frame;
+	rec->feedback = data->urb_fill_feedback[idx];
+	rec->urb = idx;
+	rec->reserved = 0;
+	rec->nr_packets = nr_packets;
+	rec->payload_bytes = payload;
+
+	p = (unsigned char *)&rec->packet_length[nr_packets];
+	if (nr_packets) {
+		for (k = 0; k < nr_packets; k++) {
+			rec->packet_length[k] = urb->iso_frame_desc[k].length;
+			memcpy(p, (unsigned char *)urb->transfer_buffer + urb->iso_frame_desc[k].offset,
+			       urb->iso_frame_desc[k].length);
+			p += urb->iso_frame_desc[k].length;
+		}
+	} else {
+		memcpy(p, urb->transfer_buffer, payload);
+		p += payload;
+	}
+	memset(p, 0, (unsigned char *)rec + size - p);
+	katana_stats.tap_records++;
+out:
+	raw_spin_unlock_irqrestore(&katana_tap_lock, flags);
+}
+
+// Each reader keeps the head as of its last read(), so poll() reports
+// records added since then
+static int katana_telemetry_open(struct inode *inode, struct file *file)
+{
+	u64 *seen = kzalloc(sizeof(*seen), GFP_KERNEL);
+
+	if (!seen)
+		return -ENOMEM;
+	*seen = atomic64_read(&katana_telemetry_head);
+	file->private_data = seen;
+	return 0;
+}
+
+static int katana_telemetry_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static __poll_t katana_telemetry_poll(struct file *file, struct poll_table_struct *wait)
+{
+	u64 *seen = file->private_data;
+	u64 head;
+
+	poll_wait(file, &katana_telemetry_wait, wait);
+	head = atomic64_read(&katana_telemetry_head);
+	if (head == READ_ONCE(*seen))
+		return 0;
+	return EPOLLIN | EPOLLRDNORM;
+}
+
+// read() is there for tools that don't map the ring; it copies it as is.
+// It also marks the records so far as seen, which is how mmap readers
+// acknowledge them before polling again.
+static ssize_t katana_telemetry_read(struct file *file, char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	u64 *seen = file->private_data;
+
+	WRITE_ONCE(*seen, atomic64_read(&katana_telemetry_head));
+	return simple_read_from_buffer(buf, count, ppos, katana_telemetry,
+				       KATANA_TELEMETRY_BYTES);
+}
+
+static int katana_telemetry_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	// Nor may it be made writable later with mprotect()
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	if (vma->vm_end - vma->vm_start > KATANA_TELEMETRY_BYTES)
+		return -EINVAL;
+	return remap_vmalloc_range(vma, katana_telemetry, vma->vm_pgoff);
+}
+
+static const struct file_operations katana_telemetry_fops = {
+	.owner = THIS_MODULE,
+	.open = katana_telemetry_open,
+	.release = katana_telemetry_release,
+	.read = katana_telemetry_read,
+	.poll = katana_telemetry_poll,
+	.mmap = katana_telemetry_mmap,
+	.llseek = default_llseek,
+};
+
+// debugfs: streaming statistics
+static int katana_stats_show(struct seq_file *s, void *unused)
+{
+	seq_printf(s, "urbs_completed: %lu\n", READ_ONCE(katana_stats.urbs_completed));
+	seq_printf(s, "schedule_gaps: %lu\n", READ_ONCE(katana_stats.schedule_gaps));
+	seq_printf(s, "frames_skipped: %lu\n", READ_ONCE(katana_stats.frames_skipped));
+	seq_printf(s, "packets_dropped: %lu\n", READ_ONCE(katana_stats.packets_dropped));
+	seq_printf(s, "frames_dropped: %lu\n", READ_ONCE(katana_stats.frames_dropped));
+	seq_printf(s, "xruns: %lu\n", READ_ONCE(katana_stats.xruns));
+	seq_printf(s, "urb_depth: %u\n", READ_ONCE(katana_stats.urb_depth));
+	seq_printf(s, "jitter_us: %u\n", READ_ONCE(katana_stats.jitter_us));
+	seq_printf(s, "depth_grows: %lu\n", READ_ONCE(katana_stats.depth_grows));
+	seq_printf(s, "depth_shrinks: %lu\n", READ_ONCE(katana_stats.depth_shrinks));
+	seq_printf(s, "complete_max_us: %u\n", READ_ONCE(katana_stats.complete_max_us));
+	seq_printf(s, "complete_overruns: %lu\n", READ_ONCE(katana_stats.complete_overruns));
+	seq_printf(s, "idle_entries: %lu\n", READ_ONCE(katana_stats.idle_entries));
+	seq_printf(s, "idle_wakeups: %lu\n", READ_ONCE(katana_stats.idle_wakeups));
+	seq_printf(s, "test_frames: %lu\n", READ_ONCE(katana_stats.test_frames));
+	seq_printf(s, "tap_records: %lu\n", READ_ONCE(katana_stats.tap_records));
+	seq_printf(s, "tap_dropped: %lu\n", READ_ONCE(katana_stats.tap_dropped));
+	seq_printf(s, "qos_us: %u\n", READ_ONCE(katana_stats.qos_us));
+	seq_printf(s, "qos_updates: %lu\n", READ_ONCE(katana_stats.qos_updates));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(katana_stats);
+
+// test_signal: shows the choices with the active one in brackets, and
+// takes the name of the signal to generate ("off" to play the PCM again)
+static ssize_t katana_test_signal_read(struct file *file, char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	int signal = READ_ONCE(katana_test_signal);
+	char text[64];
+	int len = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(katana_test_names); i++)
+		len += scnprintf(text + len, sizeof(text) - len, i == signal ? "[%s] " : "%s ",
+				 katana_test_names[i]);
+	text[len - 1] = '\n';
+	return simple_read_from_buffer(buf, count, ppos, text, len);
+}
+
+static ssize_t katana_test_signal_write(struct file *file, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	char text[16];
+	int i;
+
+	if (count >= sizeof(text))
+		return -EINVAL;
+	if (copy_from_user(text, buf, count))
+		return -EFAULT;
+	text[count] = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(katana_test_names); i++) {
+		if (sysfs_streq(text, katana_test_names[i])) {
+			WRITE_ONCE(katana_test_signal, i);
+			pr_debug("Katana PCM: Test signal %s\n", katana_test_names[i]);
+			return count;
+		}
+	}
+	return -EINVAL;
+}
+
+static const struct file_operations katana_test_signal_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = katana_test_signal_read,
+	.write = katana_test_signal_write,
+	.llseek = default_llseek,
+};
+
+// Relay buffer files live next to the other debugfs entries
+static struct dentry *katana_tap_create_buf_file(const char *filename, struct dentry *parent,
+						 umode_t mode, struct rchan_buf *buf, int *is_global)
+{
+	return debugfs_create_file(filename, mode, parent, buf, &relay_file_operations);
+}
+
+static int katana_tap_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+	return 0;
+}
+
+static const struct rchan_callbacks katana_tap_callbacks = {
+	.create_buf_file = katana_tap_create_buf_file,
+	.remove_buf_file = katana_tap_remove_buf_file,
+};
+
+// Start or stop recording. Starting discards what the channel held, so
+// each window begins at seq 0; stopping flushes the partial sub-buffers
+// so everything recorded can be read.
+static int katana_tap_set(bool enable)
+{
+	unsigned long flags;
+	int err = 0;
+
+	mutex_lock(&katana_tap_mutex);
+	if (enable == READ_ONCE(katana_tap_on))
+		goto out;
+
+	if (!enable) {
+		raw_spin_lock_irqsave(&katana_tap_lock, flags);
+		katana_tap_on = false;
+		raw_spin_unlock_irqrestore(&katana_tap_lock, flags);
+		relay_flush(katana_tap_chan);
+		goto out;
+	}
+
+	if (!katana_tap_chan) {
+		katana_tap_chan = relay_open("wire_tap", katana_debugfs_root, KATANA_TAP_SUBBUF_SIZE,
+					     KATANA_TAP_SUBBUFS, &katana_tap_callbacks, NULL);
+		if (!katana_tap_chan) {
+			err = -ENOMEM;
+			goto out;
+		}
+	} else {
+		relay_reset(katana_tap_chan);
+	}
+
+	raw_spin_lock_irqsave(&katana_tap_lock, flags);
+	katana_tap_seq = 0;
+	katana_tap_on = true;
+	raw_spin_unlock_irqrestore(&katana_tap_lock, flags);
+out:
+	mutex_unlock(&katana_tap_mutex);
+	return err;
+}
+
+static ssize_t katana_tap_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	char text[3] = { READ_ONCE(katana_tap_on) ? '1' : '0', '\n', '\0' };
+
+	return simple_read_from_buffer(buf, count, ppos, text, 2);
+}
+
+static ssize_t katana_tap_write(struct file *file, const char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	bool enable;
+	int err;
+
+	err = kstrtobool_from_user(buf, count, &enable);
+	if (err)
+		return err;
+
+	err = katana_tap_set(enable);
+	return err < 0 ? err : count;
+}
+
+static const struct file_operations katana_tap_fops = {
+	.owner = THIS_MODULE,
+	.read = katana_tap_read,
+	.write = katana_tap_write,
+	.llseek = default_llseek,
+};
+
+// Close the wire tap channel before the debugfs directory goes away
+void katana_pcm_tap_close(void)
+{
+	unsigned long flags;
+
+	mutex_lock(&katana_tap_mutex);
+	raw_spin_lock_irqsave(&katana_tap_lock, flags);
+	katana_tap_on = false;
+	raw_spin_unlock_irqrestore(&katana_tap_lock, flags);
+	if (katana_tap_chan) {
+		relay_close(katana_tap_chan);
+		katana_tap_chan = NULL;
+	}
+	mutex_unlock(&katana_tap_mutex);
+}
+
+// Create the PCM debugfs entries under the driver's directory
+void katana_pcm_debugfs_init(struct dentry *root)
+{
+	debugfs_create_file("stream_stats", 0444, root, NULL, &katana_stats_fops);
+	debugfs_create_file("test_signal", 0600, root, NULL, &katana_test_signal_fops);
+	debugfs_create_file("wire_tap_enable", 0600, root, NULL, &katana_tap_fops);
+	katana_debugfs_root = root;
+
+	// The ring outlives the device so readers keep a stable mapping
+	if (!katana_telemetry) {
+		katana_telemetry = vmalloc_user(KATANA_TELEMETRY_BYTES);
+		if (!katana_telemetry) {
+			pr_warn("Katana PCM: Failed to allocate telemetry ring\n");
+			return;
+		}
+		katana_telemetry->magic = KATANA_TELEMETRY_MAGIC;
+		katana_telemetry->version = KATANA_TELEMETRY_VERSION;
+		katana_telemetry->record_size = sizeof(struct katana_telemetry_record);
+		katana_telemetry->nr_records = KATANA_TELEMETRY_RECORDS;
+		katana_telemetry->head = atomic64_read(&katana_telemetry_head);
+	}
+	debugfs_create_file("urb_telemetry", 0444, root, NULL, &katana_telemetry_fops);
+}
+
+// Fill the stream part of a hwdep snapshot. open_mutex keeps the substream's
+// runtime and private data from going away while we look at them.
+void katana_pcm_snapshot(struct katana_hwdep_snapshot *snap)
+{
+	struct snd_pcm_substream *substream;
+	struct katana_pcm_data *data;
+	unsigned long flags;
+
+	snap->urbs_completed = katana_stats.urbs_completed;
+	snap->schedule_gaps = katana_stats.schedule_gaps;
+	snap->frames_skipped = katana_stats.frames_skipped;
+	snap->packets_dropped = katana_stats.packets_dropped;
+	snap->frames_dropped = katana_stats.frames_dropped;
+	snap->xruns = katana_stats.xruns;
+	snap->depth_grows = katana_stats.depth_grows;
+	snap->depth_shrinks = katana_stats.depth_shrinks;
+	snap->complete_overruns = katana_stats.complete_overruns;
+	snap->complete_max_us = katana_stats.complete_max_us;
+	snap->jitter_us = katana_stats.jitter_us;
+	snap->urb_depth = katana_stats.urb_depth;
+
+	if (!katana_pcm)
+		return;
+
+	mutex_lock(&katana_pcm->open_mutex);
+	substream = katana_pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+	if (substream && substream->runtime && substream->runtime->private_data) {
+		data = substream->runtime->private_data;
+
+		raw_spin_lock_irqsave(&data->lock, flags);
+		snap->running = data->running;
+		snap->rate = data->rate;
+		snap->dev_rate = data->dev_rate;
+		snap->channels = data->channels;
+		snap->buffer_size = data->buffer_size;
+		snap->period_size = data->period_size;
+		snap->num_urbs = data->num_urbs;
+		snap->hw_ptr = data->hw_ptr;
+		snap->feedback_value = data->feedback_q16;
+		snap->feedback_samples = data->feedback_samples;
+		snap->feedback_valid = data->feedback_valid;
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+	}
+	mutex_unlock(&katana_pcm->open_mutex);
+}
+
+// Free the telemetry ring (module unload, after debugfs is gone)
+void katana_pcm_telemetry_free(void)
+{
+	vfree(katana_telemetry);
+	katana_telemetry = NULL;
+}
+
+// Drop whatever latency requests the stream holds
+static void katana_qos_release(struct katana_pcm_data *data)
+{
+	if (cpu_latency_qos_request_active(&data->cpu_qos))
+		cpu_latency_qos_remove_request(&data->cpu_qos);
+	if (dev_pm_qos_request_active(&data->dev_qos))
+		dev_pm_qos_remove_request(&data->dev_qos);
+	WRITE_ONCE(katana_stats.qos_us, 0);
+}
+
+// Bring the latency requests in line with the stream. The budget is half
+// the time covered by the URBs queued behind the one completing, the same
+// margin the adaptive depth treats as a near miss, so a CPU waking from idle
+// still refills in time. Parked, paused and stopped streams hold nothing.
+static void katana_qos_work(struct work_struct *work)
+{
+	struct katana_pcm_data *data = container_of(work, struct katana_pcm_data, qos_work);
+	unsigned long flags;
+	unsigned int budget_us = 0;
+	int dev_valid;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	if (data->running && data->stream_started && !data->idle &&
+	    data->target_urbs >= KATANA_MIN_URBS)
+		budget_us = (data->target_urbs - 1) * data->urb_period_us / 2;
+	dev_valid = data->usb_dev_valid;
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	if (!READ_ONCE(latency_qos) || budget_us >= KATANA_QOS_CEILING_US)
+		budget_us = 0;
+	if (budget_us == READ_ONCE(katana_stats.qos_us) &&
+	    cpu_latency_qos_request_active(&data->cpu_qos) == !!budget_us)
+		return;
+
+	if (!budget_us) {
+		katana_qos_release(data);
+	} else {
+		if (cpu_latency_qos_request_active(&data->cpu_qos))
+			cpu_latency_qos_update_request(&data->cpu_qos, budget_us);
+		else
+			cpu_latency_qos_add_request(&data->cpu_qos, budget_us);
+
+		if (!READ_ONCE(resume_latency_qos) || !dev_valid) {
+			if (dev_pm_qos_request_active(&data->dev_qos))
+				dev_pm_qos_remove_request(&data->dev_qos);
+		} else if (dev_pm_qos_request_active(&data->dev_qos)) {
+			dev_pm_qos_update_request(&data->dev_qos, budget_us);
+		} else if (dev_pm_qos_add_request(&data->usb_dev->dev, &data->dev_qos,
+						  DEV_PM_QOS_RESUME_LATENCY, budget_us) < 0) {
+			pr_debug("Katana PCM: Failed to add resume latency request\n");
+		}
+	}
+
+	pr_debug("Katana PCM: Latency QoS budget %u us\n", budget_us);
+	WRITE_ONCE(katana_stats.qos_us, budget_us);
+	katana_stats.qos_updates++;
+}
+
 // Open playback substream
 int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 {
@@ -343,7 +2067,29 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	data->substream = substream;
 	data->usb_dev = usb_dev;
 	data->usb_dev_valid = 1; // Mark USB device as valid
-	spin_lock_init(&data->lock);
+	raw_spin_lock_init(&data->lock);
+	data->dither_seed = get_random_u32() | 1; // xorshift must not start at 0
+	
+	// Optional RT fill worker
+	data->fill_worker = NULL;
+	data->fill_pending = 0;
+	kthread_init_work(&data->fill_work, katana_fill_work);
+	timer_setup(&data->idle_timer, katana_idle_timer, 0);
+	INIT_WORK(&data->qos_work, katana_qos_work);
+	if (rt_fill) {
+		// Since 6.14 kthread_create_worker() leaves the thread asleep
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 14, 0)
+		data->fill_worker = kthread_run_worker(0, "katana-fill");
+#else
+		data->fill_worker = kthread_create_worker(0, "katana-fill");
+#endif
+		if (IS_ERR(data->fill_worker)) {
+			pr_warn("Katana PCM: Failed to create fill worker, filling inline\n");
+			data->fill_worker = NULL;
+		} else {
+			sched_set_fifo(data->fill_worker->task);
+		}
+	}
 	
 	// Initialize buffer tracking
 	data->buffer_size = 0;
@@ -351,10 +2097,15 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	data->period_bytes = 0;
 	data->channels = 0;
 	data->rate = 0;
+	data->dev_rate = 0;
+	data->resampling = 0;
 	data->format = 0;
 	data->hw_ptr = 0;
 	data->last_period_hw_ptr = 0;
 	data->read_ptr = 0;
+	data->read_abs = 0;
+	data->next_frame = 0;
+	data->next_frame_valid = 0;
 	data->running = 0;
 	data->prepared = 0;
 	data->start_time = 0;
@@ -366,7 +2117,12 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	data->num_urbs = 0;
 	data->urb_buffer_size = 0;
 	data->stream_started = 0;
-	data->active_urbs = 0;
+	data->stopping = 0;
+	data->urbs_in_flight = 0;
+	data->sync_in_flight = 0;
+	init_waitqueue_head(&data->stop_wait);
+	data->target_urbs = 0;
+	data->urb_period_us = 0;
 	data->usb_iface = NULL;
 	data->endpoint_out = 0;
 	data->endpoint_sync = 0;
@@ -380,6 +2136,9 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	// Initialize feedback processing fields
 	data->feedback_value = 0;
 	data->feedback_samples = 0;
+	data->feedback_q16 = 0;
+	data->packet_phase = 0;
+	data->packet_max_frames = 0;
 	data->target_samples = 0;
 	data->feedback_count = 0;
 	data->feedback_average = 0;
@@ -389,6 +2148,8 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	err = katana_find_audio_endpoint(data);
 	if (err < 0) {
 		pr_err("Katana PCM: Failed to find audio endpoint: %d\n", err);
+		if (data->fill_worker)
+			kthread_destroy_worker(data->fill_worker);
 		kfree(data);
 		katana_exit_operation();
 		return err;
@@ -398,10 +2159,29 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 	substream->runtime->hw = katana_pcm_playback_hw;
 	substream->runtime->private_data = data;
 	
+	// Offer the 44.1kHz family through the resampler unless the device
+	// could take it natively
+	if (data->uac2)
+		katana_uac2_setup_rates(data, substream->runtime);
+	else
+		data->native_44k = katana_device_has_44k(data);
+	if (data->native_44k)
+		pr_debug("Katana PCM: Device lists a 44.1kHz rate, not offering resampled rates\n");
+	
 	// Set DMA buffer constraints
-	snd_pcm_hw_constraint_list(substream->runtime, 0,
-				   SNDRV_PCM_HW_PARAM_RATE,
-				   &katana_rate_constraints);
+	if (data->uac2) {
+		// Rate list set up from the clock source above
+	} else if (resample && !data->native_44k) {
+		substream->runtime->hw.rates |= SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_88200;
+		substream->runtime->hw.rate_min = 44100;
+		snd_pcm_hw_constraint_list(substream->runtime, 0,
+					   SNDRV_PCM_HW_PARAM_RATE,
+					   &katana_resample_rate_constraints);
+	} else {
+		snd_pcm_hw_constraint_list(substream->runtime, 0,
+					   SNDRV_PCM_HW_PARAM_RATE,
+					   &katana_rate_constraints);
+	}
 	snd_pcm_hw_constraint_list(substream->runtime, 0,
 				   SNDRV_PCM_HW_PARAM_CHANNELS,
 				   &katana_channel_constraints);
@@ -437,6 +2217,10 @@ int katana_pcm_playback_open(struct snd_pcm_substream *substream)
 // Invalidate USB device in PCM data (called on disconnect)
 void katana_pcm_invalidate_usb_dev(struct snd_card *card)
 {
+	struct snd_pcm_substream *substream;
+	struct katana_pcm_data *data;
+	unsigned long flags;
+	
 	if (!card) {
 		pr_warn("Katana PCM: Card is NULL in invalidate_usb_dev\n");
 		return;
@@ -445,6 +2229,23 @@ void katana_pcm_invalidate_usb_dev(struct snd_card *card)
 	// Mark all PCM private data as having invalid USB devices
 	// This prevents further USB operations but allows buffer cleanup to continue
 	// The individual PCM operations will handle the invalid USB device gracefully
+	if (!katana_pcm || katana_pcm->card != card)
+		return;
+	
+	mutex_lock(&katana_pcm->open_mutex);
+	substream = katana_pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream;
+	if (substream && substream->runtime && substream->runtime->private_data) {
+		data = substream->runtime->private_data;
+		
+		raw_spin_lock_irqsave(&data->lock, flags);
+		data->usb_dev_valid = 0;
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		
+		// No latency request may stay on a device being unbound
+		cancel_work_sync(&data->qos_work);
+		katana_qos_release(data);
+	}
+	mutex_unlock(&katana_pcm->open_mutex);
 }
 
 // Close playback substream
@@ -458,7 +2259,12 @@ int katana_pcm_playback_close(struct snd_pcm_substream *substream)
 	if (data) {
 		// Stop streaming and free URB buffers
 		data->stream_started = 0;
+		timer_delete_sync(&data->idle_timer);
+		cancel_work_sync(&data->qos_work);
+		katana_qos_release(data);
 		katana_free_urb_buffers(data);
+		if (data->fill_worker)
+			kthread_destroy_worker(data->fill_worker);
 		
 		kfree(data);
 		substream->runtime->private_data = NULL;  // CRITICAL: Clear dangling pointer
@@ -502,6 +2308,10 @@ int katana_pcm_hw_params(struct snd_pcm_substream *substream,
 	data->channels = params_channels(hw_params);
 	data->rate = params_rate(hw_params);
 	data->format = params_format(hw_params);
+	
+	// 44.1kHz family streams run the device at the next 48kHz family rate
+	data->resampling = !data->native_44k && data->rate % 44100 == 0;
+	data->dev_rate = data->resampling ? data->rate / KATANA_RS_STEP * KATANA_RS_PHASES : data->rate;
 
 	buffer_bytes = params_buffer_bytes(hw_params);
 	periods = params_periods(hw_params);
@@ -563,17 +2373,18 @@ int katana_pcm_hw_params(struct snd_pcm_substream *substream,
 	katana_free_urb_buffers(data);
 
 	// Step 3: Set up URB parameters for USB streaming  
-	data->num_urbs = 6;  // 6 URBs for streaming
+	data->num_urbs = KATANA_NUM_URBS;
 	
 	// Calculate URB buffer size based on isochronous packet structure
-	// Each URB will contain multiple packets (8ms worth of data)
-	unsigned int packets_per_urb = 8;
-	unsigned int samples_per_packet = data->rate / 1000;  // 1ms worth of samples
+	// Each URB will contain multiple packets (8ms worth at full speed)
+	unsigned int packets_per_urb = KATANA_PACKETS_PER_URB;
+	unsigned int samples_per_packet = data->dev_rate / data->packets_per_sec;
 	unsigned int packet_size = samples_per_packet * frame_size;
 	data->urb_buffer_size = packets_per_urb * packet_size;
+	data->urb_period_us = packets_per_urb * USEC_PER_SEC / data->packets_per_sec;
 	
 	data->stream_started = 0;
-	data->active_urbs = 0;
+	data->stopping = 0;
 
 	// URB setup complete
 
@@ -650,23 +2461,28 @@ int katana_pcm_prepare(struct snd_pcm_substream *substream)
 		katana_exit_operation();
 		return -ENODEV;
 	}
-
-	// Select correct alternate setting based on sample rate
-	// From USB descriptors: altsetting 1 = 48kHz, altsetting 2 = 96kHz
-	switch (data->rate) {
-	case 48000:
-		target_altsetting = 1;
-		break;
-	case 96000:
-		target_altsetting = 2;
-		break;
-	default:
-		pr_err("Katana PCM: Unsupported sample rate %u\n", data->rate);
-		katana_exit_operation();
-		return -EINVAL;
+
+	// Select correct alternate setting based on sample rate
+	// From USB descriptors: altsetting 1 = 48kHz, altsetting 2 = 96kHz.
+	// UAC2 altsettings only select the format; the clock sets the rate.
+	if (data->uac2) {
+		target_altsetting = data->altsetting_num;
+	} else {
+		switch (data->dev_rate) {
+		case 48000:
+			target_altsetting = 1;
+			break;
+		case 96000:
+			target_altsetting = 2;
+			break;
+		default:
+			pr_err("Katana PCM: Unsupported sample rate %u\n", data->dev_rate);
+			katana_exit_operation();
+			return -EINVAL;
+		}
 	}
 
-	spin_lock_irqsave(&data->lock, flags);
+	raw_spin_lock_irqsave(&data->lock, flags);
 	
 	data->hw_ptr = 0;
 	data->last_period_hw_ptr = 0;
@@ -674,7 +2490,7 @@ int katana_pcm_prepare(struct snd_pcm_substream *substream)
 	data->running = 0;
 	data->start_time = jiffies;
 
-	spin_unlock_irqrestore(&data->lock, flags);
+	raw_spin_unlock_irqrestore(&data->lock, flags);
 
 	// Activate the USB interface for streaming (process context - can sleep)
 	err = katana_set_interface_altsetting(data, target_altsetting);
@@ -685,7 +2501,7 @@ int katana_pcm_prepare(struct snd_pcm_substream *substream)
 	}
 
 	// Configure the sample rate on the device
-	err = katana_set_sample_rate(data, data->rate);
+	err = katana_set_sample_rate(data, data->dev_rate);
 	if (err < 0) {
 		pr_err("Katana PCM: Failed to set sample rate during prepare: %d\n", err);
 		katana_exit_operation();
@@ -697,14 +2513,198 @@ int katana_pcm_prepare(struct snd_pcm_substream *substream)
 	return 0;
 }
 
+// Submit the URBs claimed by TRIGGER_START or an idle wake (called without
+// data->lock). With fill set they carry audio from read_ptr, otherwise the
+// ring starts out as silence.
+static int katana_start_urbs(struct katana_pcm_data *data, int submit_sync,
+			     unsigned long submit_mask, int fill)
+{
+	unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
+	unsigned int samples_per_packet = data->dev_rate / data->packets_per_sec;  // Nominal packet
+	unsigned int packet_size = samples_per_packet * frame_size;
+	unsigned long flags;
+	int err = 0;
+	int i, j;
+
+	// Start sync URB first to receive feedback
+	if (submit_sync) {
+		err = katana_submit_claimed_urb(data, data->sync_urb);
+		if (err < 0)
+			pr_err("Katana PCM: Failed to submit sync URB: %d\n", err);
+	}
+
+	// Start URB streaming
+	for_each_set_bit(i, &submit_mask, data->num_urbs) {
+		if (err < 0) {
+			// Never submitted - drop the claim
+			raw_spin_lock_irqsave(&data->lock, flags);
+			katana_retire_urb_locked(data, data->urbs[i]);
+			raw_spin_unlock_irqrestore(&data->lock, flags);
+			continue;
+		}
+		
+		if (fill) {
+			// Stream stopped meanwhile, the claim is already dropped
+			if (katana_fill_urb(data, data->urbs[i], i) < 0)
+				continue;
+		} else {
+			// Initialize URB buffer with silence
+			memset(data->urb_buffers[i], 0, data->urb_buffer_size);
+			
+			// For isochronous URBs, ensure packet descriptors are set up
+			if (usb_pipeisoc(data->urbs[i]->pipe)) {
+				for (j = 0; j < data->urbs[i]->number_of_packets; j++) {
+					data->urbs[i]->iso_frame_desc[j].offset = j * packet_size;
+					data->urbs[i]->iso_frame_desc[j].length = packet_size;
+				}
+			}
+		}
+		
+		err = katana_submit_claimed_urb(data, data->urbs[i]);
+		if (err < 0)
+			pr_err("Katana PCM: Failed to submit URB %d: %d\n", i, err);
+	}
+
+	return err;
+}
+
+// Stop streaming and request asynchronous unlinks of everything in flight
+// Doesn't wait: completions retire the URBs and .sync_stop waits for the
+// last one.
+static void katana_stop_urbs(struct katana_pcm_data *data)
+{
+	unsigned long flags;
+	unsigned long unlink_mask;
+	int unlink_sync;
+	int i;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	data->running = 0;
+	data->stream_started = 0;
+	data->idle = 0;
+	if (data->urbs_in_flight || data->sync_in_flight)
+		data->stopping = 1;
+	unlink_mask = data->urbs_in_flight;
+	unlink_sync = data->sync_in_flight;
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	// A tick already running sees the stream stopped and doesn't rearm
+	timer_delete(&data->idle_timer);
+	schedule_work(&data->qos_work);
+
+	// Meters fall back to zero with the stream
+	raw_spin_lock_irqsave(&katana_meter_lock, flags);
+	memset(katana_meter_peak, 0, sizeof(katana_meter_peak));
+	memset(katana_meter_rms, 0, sizeof(katana_meter_rms));
+	raw_spin_unlock_irqrestore(&katana_meter_lock, flags);
+	katana_control_meter_changed(1);
+
+	// Stop sync URB first
+	if (unlink_sync)
+		usb_unlink_urb(data->sync_urb);
+
+	// Stop URB streaming (use unlink in atomic context)
+	for_each_set_bit(i, &unlink_mask, data->num_urbs)
+		usb_unlink_urb(data->urbs[i]);
+}
+
+// Idle tick: with every URB parked, consume the PCM buffer at the nominal
+// rate and restart streaming as soon as the application writes sound.
+// The restarted URBs are filled from read_ptr, so the device picks up where
+// the idle clock left off. Looking one URB ring ahead gets them streaming
+// before the sound is due.
+static void katana_idle_timer(struct timer_list *t)
+{
+	struct katana_pcm_data *data = container_of(t, struct katana_pcm_data, idle_timer);
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	unsigned long submit_mask = 0;
+	unsigned int pending;
+	unsigned int advance = 0;
+	unsigned int lookahead;
+	unsigned int check;
+	unsigned int start;
+	int submit_sync = 0;
+	int period_elapsed = 0;
+	int wake;
+	u64 due;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	if (!data->idle || !data->running || !data->stream_started) {
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
+	}
+	if (data->urbs_in_flight || data->sync_in_flight) {
+		// Still draining, completions move the pointers
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		mod_timer(&data->idle_timer, jiffies + msecs_to_jiffies(KATANA_IDLE_TICK_MS));
+		return;
+	}
+	if (!data->idle_start) {
+		data->idle_start = now;
+		data->idle_frames = 0;
+	}
+	due = div_u64((u64)ktime_us_delta(now, data->idle_start) * data->rate, USEC_PER_SEC);
+	pending = katana_pending_frames(data);
+	advance = min_t(u64, due - data->idle_frames, pending);
+	lookahead = data->rate / data->packets_per_sec * KATANA_PACKETS_PER_URB * data->num_urbs;
+	check = min(pending, advance + lookahead);
+	start = data->read_ptr;
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	wake = !katana_frames_silent(data, start, check);
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	if (!data->idle || !data->running || !data->stream_started) {
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
+	}
+	if (wake) {
+		data->idle = 0;
+		data->silent_frames = 0;
+		data->next_frame_valid = 0;
+		data->last_complete = 0;
+		data->rs_phase = 0;
+		memset(data->rs_hist, 0, sizeof(data->rs_hist));
+		katana_stats.idle_wakeups++;
+		submit_mask = katana_claim_ring_locked(data, &submit_sync);
+	} else {
+		// Time the application fell short of is gone, as with a real underrun
+		data->idle_frames = due;
+		katana_advance_read_ptr(data, advance);
+		data->hw_ptr += advance;
+		if (data->hw_ptr >= data->buffer_size)
+			data->hw_ptr -= data->buffer_size;
+		if (data->hw_ptr / data->period_size != data->last_period_hw_ptr / data->period_size) {
+			data->last_period_hw_ptr = data->hw_ptr;
+			period_elapsed = 1;
+		}
+	}
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	if (wake) {
+		if (katana_start_urbs(data, submit_sync, submit_mask, 1) < 0)
+			snd_pcm_stop_xrun(data->substream);
+		else
+			schedule_work(&data->qos_work);
+		return;
+	}
+
+	if (period_elapsed)
+		snd_pcm_period_elapsed(data->substream);
+	mod_timer(&data->idle_timer, jiffies + msecs_to_jiffies(KATANA_IDLE_TICK_MS));
+}
+
 // Trigger playback
 int katana_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct katana_pcm_data *data = substream->runtime->private_data;
 	unsigned long flags;
-	int err;
+	unsigned long submit_mask = 0;
+	int submit_sync = 0;
+	int err = 0;
 	int should_block = 0;
-	int i, j;
+	int idle = 0;
 
 	// Determine if we should block this operation during disconnect
 	switch (cmd) {
@@ -743,7 +2743,9 @@ int katana_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		return -ENODEV;
 	}
 
-	spin_lock_irqsave(&data->lock, flags);
+	// USB core calls may take sleeping locks on PREEMPT_RT, so only state
+	// changes happen under data->lock; submissions and unlinks follow below.
+	raw_spin_lock_irqsave(&data->lock, flags);
 
 	switch (cmd) {
 	case SNDRV_PCM_TRIGGER_START:
@@ -753,69 +2755,33 @@ int katana_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		data->hw_ptr = 0;
 		data->last_period_hw_ptr = 0;
 		data->read_ptr = 0;
+		data->read_abs = READ_ONCE(substream->runtime->status->hw_ptr);
+		data->next_frame_valid = 0;
+		data->packet_phase = 0;
+		data->rs_phase = 0;
+		memset(data->rs_hist, 0, sizeof(data->rs_hist));
 		
-		// Start sync URB first to receive feedback
-		err = usb_submit_urb(data->sync_urb, GFP_ATOMIC);
-		if (err < 0) {
-			pr_err("Katana PCM: Failed to submit sync URB: %d\n", err);
-			data->running = 0;
-			data->stream_started = 0;
-			spin_unlock_irqrestore(&data->lock, flags);
-			if (should_block) katana_exit_operation();
-			return err;
-		}
+		// Adaptive depth starts from the full ring and shrinks once safe
+		data->target_urbs = data->num_urbs;
+		data->last_complete = 0;
+		data->window_jitter_us = 0;
+		data->window_margin = UINT_MAX;
+		data->window_count = 0;
+		data->calm_windows = 0;
+		katana_stats.urb_depth = data->target_urbs;
 		
-		// Start URB streaming
-		for (i = 0; i < data->num_urbs; i++) {
-			// Initialize URB buffer with silence
-			memset(data->urb_buffers[i], 0, data->urb_buffer_size);
-			
-			// For isochronous URBs, ensure packet descriptors are set up
-			if (usb_pipeisoc(data->urbs[i]->pipe)) {
-				// Packet descriptors were set up in katana_alloc_urb_buffers
-				// Just make sure they're properly initialized
-				unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
-				unsigned int samples_per_packet = data->rate / 1000;  // Nominal 1ms worth
-				unsigned int packet_size = samples_per_packet * frame_size;
-				
-				for (j = 0; j < data->urbs[i]->number_of_packets; j++) {
-					data->urbs[i]->iso_frame_desc[j].offset = j * packet_size;
-					data->urbs[i]->iso_frame_desc[j].length = packet_size;
-				}
-			}
-			
-			// Submit URB
-			err = usb_submit_urb(data->urbs[i], GFP_ATOMIC);
-			if (err < 0) {
-				pr_err("Katana PCM: Failed to submit URB %d: %d\n", i, err);
-				// Stop already submitted URBs
-				for (j = i - 1; j >= 0; j--) {
-					usb_unlink_urb(data->urbs[j]);
-				}
-				usb_unlink_urb(data->sync_urb);
-				data->running = 0;
-				data->stream_started = 0;
-				spin_unlock_irqrestore(&data->lock, flags);
-				if (should_block) katana_exit_operation();
-				return err;
-			}
-		}
+		data->idle = 0;
+		data->silent_frames = 0;
+		memset(data->meter_peak, 0, sizeof(data->meter_peak));
+		memset(data->meter_sum, 0, sizeof(data->meter_sum));
+		data->meter_frames = 0;
+		data->test_count = 0;
+		data->test_lfsr = 1;
 		
-		// Playback started
+		submit_mask = katana_claim_ring_locked(data, &submit_sync);
 		break;
 		
 	case SNDRV_PCM_TRIGGER_STOP:
-		data->running = 0;
-		data->stream_started = 0;
-		
-		// Stop sync URB first
-		usb_unlink_urb(data->sync_urb);
-		
-		// Stop URB streaming (use unlink in atomic context)
-		for (i = 0; i < data->num_urbs; i++) {
-			usb_unlink_urb(data->urbs[i]);
-		}
-		
 		break;
 		
 	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
@@ -824,16 +2790,90 @@ int katana_pcm_trigger(struct snd_pcm_substream *substream, int cmd)
 		
 	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
 		data->running = 1;
+		idle = data->idle;
+		if (idle) {
+			// The idle clock doesn't count the paused time
+			data->idle_start = 0;
+		} else {
+			// URBs retired while paused; take the ring back and
+			// refill it from the PCM, like an idle wake
+			data->next_frame_valid = 0;
+			data->last_complete = 0;
+			submit_mask = katana_claim_ring_locked(data, &submit_sync);
+		}
 		break;
 		
 	default:
-		spin_unlock_irqrestore(&data->lock, flags);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
 		if (should_block) katana_exit_operation();
 		return -EINVAL;
 	}
 
-	spin_unlock_irqrestore(&data->lock, flags);
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+		err = katana_start_urbs(data, submit_sync, submit_mask, 0);
+		if (err < 0) {
+			// Stop already submitted URBs, .sync_stop waits for them
+			katana_stop_urbs(data);
+		} else {
+			schedule_work(&data->qos_work);
+		}
+		break;
+		
+	case SNDRV_PCM_TRIGGER_STOP:
+		katana_stop_urbs(data);
+		break;
+		
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		schedule_work(&data->qos_work);
+		break;
+		
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		if (idle) {
+			mod_timer(&data->idle_timer, jiffies + msecs_to_jiffies(KATANA_IDLE_TICK_MS));
+		} else {
+			err = katana_start_urbs(data, submit_sync, submit_mask, 1);
+			if (err < 0) {
+				// Stop already submitted URBs, .sync_stop waits for them
+				katana_stop_urbs(data);
+				break;
+			}
+		}
+		schedule_work(&data->qos_work);
+		break;
+	}
+
 	if (should_block) katana_exit_operation();
+	return err;
+}
+
+// Wait for URBs unlinked by TRIGGER_STOP to be handed back
+// Called by ALSA in process context before prepare, hw_free and close.
+int katana_pcm_sync_stop(struct snd_pcm_substream *substream)
+{
+	struct katana_pcm_data *data = substream->runtime->private_data;
+	int i;
+
+	if (!data || !data->urbs)
+		return 0;
+
+	timer_delete_sync(&data->idle_timer);
+
+	if (wait_event_timeout(data->stop_wait, katana_urbs_retired(data),
+			       msecs_to_jiffies(KATANA_STOP_TIMEOUT_MS)))
+		return 0;
+
+	// Unlinks didn't complete in time - kill synchronously as a fallback
+	pr_warn("Katana PCM: URBs still in flight %u ms after stop, killing them\n",
+		KATANA_STOP_TIMEOUT_MS);
+	if (data->sync_urb)
+		usb_kill_urb(data->sync_urb);
+	for (i = 0; i < data->num_urbs; i++) {
+		if (data->urbs[i])
+			usb_kill_urb(data->urbs[i]);
+	}
 	return 0;
 }
 
@@ -856,240 +2896,208 @@ snd_pcm_uframes_t katana_pcm_pointer(struct snd_pcm_substream *substream)
 		return 0;
 	}
 
-	spin_lock_irqsave(&data->lock, flags);
+	raw_spin_lock_irqsave(&data->lock, flags);
 	
 	// Always return the actual hardware pointer
 	pos = data->hw_ptr;
 
-	spin_unlock_irqrestore(&data->lock, flags);
+	raw_spin_unlock_irqrestore(&data->lock, flags);
 	return pos;
 }
 
+// Refill a data URB and hand it back to the USB core (called without data->lock)
+// With a fill worker the copy is deferred to it, so the completion callback
+// only does pointer bookkeeping.
+static void katana_refill_urb(struct katana_pcm_data *data, struct urb *urb, int idx)
+{
+	unsigned long flags;
+
+	if (data->fill_worker) {
+		raw_spin_lock_irqsave(&data->lock, flags);
+		__set_bit(idx, &data->fill_pending);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		kthread_queue_work(data->fill_worker, &data->fill_work);
+		return;
+	}
+
+	if (katana_fill_urb(data, urb, idx) < 0)
+		return;
+
+	if (katana_submit_claimed_urb(data, urb) < 0)
+		pr_err("Katana URB resubmit failed\n");
+}
+
+// Fill worker: does the copies queued by katana_refill_urb() at RT priority
+static void katana_fill_work(struct kthread_work *work)
+{
+	struct katana_pcm_data *data = container_of(work, struct katana_pcm_data, fill_work);
+	unsigned long flags;
+	unsigned long pending;
+	int idx;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
+	pending = data->fill_pending;
+	data->fill_pending = 0;
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	for_each_set_bit(idx, &pending, data->num_urbs) {
+		if (katana_fill_urb(data, data->urbs[idx], idx) < 0)
+			continue;
+		if (katana_submit_claimed_urb(data, data->urbs[idx]) < 0)
+			pr_err("Katana URB resubmit failed\n");
+	}
+}
+
+// Record how long a completion callback took and flag budget overruns
+static void katana_account_complete_time(ktime_t entry)
+{
+	unsigned int elapsed_us = ktime_us_delta(ktime_get(), entry);
+
+	if (elapsed_us > katana_stats.complete_max_us)
+		katana_stats.complete_max_us = elapsed_us;
+
+	if (complete_budget_us && elapsed_us > complete_budget_us) {
+		katana_stats.complete_overruns++;
+		pr_warn_ratelimited("Katana PCM: URB completion took %u us (budget %u us)\n",
+				    elapsed_us, complete_budget_us);
+	}
+}
+
 // URB completion handler for audio streaming
+// Only pointer bookkeeping happens under data->lock; the buffer copy and the
+// resubmission run after it is dropped (or in the fill worker).
 static void katana_urb_complete(struct urb *urb)
 {
 	struct katana_pcm_data *data = urb->context;
 	struct snd_pcm_substream *substream = data->substream;
+	ktime_t entry = ktime_get();
 	unsigned long flags;
-	int err;
 	unsigned int frames_transferred = 0;
-	unsigned int frame_size;
-	char *pcm_buffer;
-	unsigned int copy_offset;
-	unsigned int available_frames;
-	static unsigned int urb_count = 0;
-	int k;
+	unsigned int feedback;
+	unsigned int appl_margin;
+	unsigned int in_flight;
+	int period_elapsed = 0;
+	int broken = 0;
+	int refill = 0;
+	int grow_idx = -1;
+	int idx;
+
+	raw_spin_lock_irqsave(&data->lock, flags);
 
 	if (!data->stream_started) {
-		return; // Stream was stopped
+		// Stream was stopped - this URB is back with us for good
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
 	}
 
-	spin_lock_irqsave(&data->lock, flags);
-	urb_count++;
+	idx = katana_urb_index(data, urb);
+	if (idx < 0) {
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
+	}
 	
 	switch (urb->status) {
 	case 0:
-		// Success - calculate frames transferred
-		frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
-		
-		if (usb_pipeisoc(urb->pipe)) {
-			// For isochronous URBs, sum up actual lengths of all packets
-			for (k = 0; k < urb->number_of_packets; k++) {
-				frames_transferred += urb->iso_frame_desc[k].actual_length / frame_size;
-			}
-		} else {
-			// For bulk URBs, use total actual length
-			frames_transferred = urb->actual_length / frame_size;
-		}
-		
-		// Update hardware pointer
-		data->hw_ptr += frames_transferred;
-		if (data->hw_ptr >= data->buffer_size) {
-			data->hw_ptr -= data->buffer_size;
-		}
-		
-		// Check for period elapsed
-		unsigned int current_period = data->hw_ptr / data->period_size;
-		unsigned int last_period = data->last_period_hw_ptr / data->period_size;
-		int period_elapsed = 0;
-		
-		if (current_period != last_period) {
-			data->last_period_hw_ptr = data->hw_ptr;
-			period_elapsed = 1;
-		}
-		
-		// Progress tracking removed to reduce log noise
-		
-		spin_unlock_irqrestore(&data->lock, flags);
-		
-		if (period_elapsed) {
-			snd_pcm_period_elapsed(substream);
-		}
 		break;
 		
 	case -ENOENT:
 	case -ECONNRESET:
 	case -ESHUTDOWN:
 		// URB was cancelled - normal shutdown
-		goto exit_unlock;
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
 	default:
 		// URB error - log only serious errors
 		if (urb->status != -EPROTO && urb->status != -EILSEQ) {
-			pr_err("Katana URB error: status %d\n", urb->status);
+			pr_err_ratelimited("Katana URB error: status %d\n", urb->status);
 		}
-		goto exit_unlock;
+		// The whole URB is lost: account for its frames like dropped
+		// packets and carry on below, so the ring keeps its size
+		if (usb_pipeisoc(urb->pipe))
+			katana_stats.packets_dropped += urb->number_of_packets;
+		katana_stats.frames_dropped += data->urb_src_frames[idx];
+		data->next_frame_valid = 0;
+		broken = 1;
+		break;
 	}
 
-	// Reacquire lock for URB processing
-	spin_lock_irqsave(&data->lock, flags);
+	// Success - look for frames the host controller skipped or dropped
+	if (!broken && usb_pipeisoc(urb->pipe)) {
+		broken = katana_check_continuity(data, urb);
+	}
+	katana_stats.urbs_completed++;
+	
+	// Advance by what this URB took out of the PCM buffer. Silence
+	// padding doesn't count, and frames in dropped packets are gone
+	// either way, so hw_ptr stays in step with read_ptr.
+	frames_transferred = data->urb_src_frames[idx];
+	data->urb_src_frames[idx] = 0;
+	feedback = data->feedback_value;
+	
+	// Update hardware pointer
+	data->hw_ptr += frames_transferred;
+	if (data->hw_ptr >= data->buffer_size) {
+		data->hw_ptr -= data->buffer_size;
+	}
 	
-	// Prepare next URB with data from PCM buffer
-	if (data->stream_started && data->running) {
-		frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
-		
-		// Calculate samples per packet based on feedback data
-		unsigned int samples_per_packet;
-		if (data->feedback_valid && data->feedback_samples > 0) {
-			// Use feedback data - it represents samples per 1ms frame
-			samples_per_packet = data->feedback_samples;
-		} else {
-			// Fallback to nominal rate-based calculation
-			samples_per_packet = data->rate / 1000;
-		}
-		
-		// Get PCM buffer pointer
-		pcm_buffer = substream->runtime->dma_area;
+	// Check for period elapsed
+	if (data->hw_ptr / data->period_size != data->last_period_hw_ptr / data->period_size) {
+		data->last_period_hw_ptr = data->hw_ptr;
+		period_elapsed = 1;
+	}
+	
+	if (broken && xrun_on_gap) {
+		// The xrun stops the stream; the URB is retired below
+		katana_stats.xruns++;
+	} else if (data->running && !data->idle) {
+		// Decide what happens to this URB next
+		in_flight = hweight_long(data->urbs_in_flight);
+		refill = 1;
 		
-		if (usb_pipeisoc(urb->pipe)) {
-			// Handle isochronous transfer with multiple packets
-			unsigned int total_samples_needed = 0;
-			unsigned int packet_size = samples_per_packet * frame_size;
-			
-			// Update packet descriptors based on current feedback
-			for (k = 0; k < urb->number_of_packets; k++) {
-				// Adjust packet size based on feedback
-				// For precise timing, we might need to vary packet sizes slightly
-				unsigned int this_packet_samples = samples_per_packet;
-				unsigned int this_packet_size = this_packet_samples * frame_size;
-				
-				// Ensure packet doesn't exceed buffer bounds
-				if ((k + 1) * packet_size > data->urb_buffer_size) {
-					this_packet_size = data->urb_buffer_size - (k * packet_size);
-					this_packet_samples = this_packet_size / frame_size;
-				}
-				
-				urb->iso_frame_desc[k].offset = k * packet_size;
-				urb->iso_frame_desc[k].length = this_packet_size;
-				total_samples_needed += this_packet_samples;
-			}
-			
-			// Calculate available data in PCM buffer
-			snd_pcm_uframes_t appl_ptr = READ_ONCE(substream->runtime->control->appl_ptr);
-			snd_pcm_uframes_t appl_pos = appl_ptr % data->buffer_size;
-			
-			if (appl_pos >= data->read_ptr) {
-				available_frames = appl_pos - data->read_ptr;
-			} else {
-				available_frames = data->buffer_size - data->read_ptr + appl_pos;
-			}
-			
-			// Limit to available data
-			if (total_samples_needed > available_frames) {
-				total_samples_needed = available_frames;
-			}
-			
-			// Fill URB buffer with audio data
-			if (pcm_buffer && total_samples_needed > 0) {
-				unsigned int samples_copied = 0;
-				
-				for (k = 0; k < urb->number_of_packets && samples_copied < total_samples_needed; k++) {
-					unsigned int packet_samples = urb->iso_frame_desc[k].length / frame_size;
-					unsigned int samples_to_copy = min(packet_samples, total_samples_needed - samples_copied);
-					unsigned int copy_size = samples_to_copy * frame_size;
-					
-					// Calculate source offset in PCM buffer
-					copy_offset = ((data->read_ptr + samples_copied) % data->buffer_size) * frame_size;
-					
-					// Copy data to URB buffer
-					unsigned char *dest = data->urb_buffers[urb_count % data->num_urbs] + urb->iso_frame_desc[k].offset;
-					
-					if (copy_offset + copy_size <= substream->runtime->dma_bytes) {
-						memcpy(dest, pcm_buffer + copy_offset, copy_size);
-					} else {
-						// Handle wraparound
-						unsigned int first_part = substream->runtime->dma_bytes - copy_offset;
-						unsigned int second_part = copy_size - first_part;
-						memcpy(dest, pcm_buffer + copy_offset, first_part);
-						memcpy(dest + first_part, pcm_buffer, second_part);
-					}
-					
-					samples_copied += samples_to_copy;
-					
-					// Update actual packet length
-					urb->iso_frame_desc[k].length = copy_size;
-				}
-				
-				// Update read pointer
-				data->read_ptr = (data->read_ptr + samples_copied) % data->buffer_size;
-				
-				// Debug logging removed to reduce noise
-			} else {
-				// Fill with silence
-				for (k = 0; k < urb->number_of_packets; k++) {
-					unsigned char *dest = data->urb_buffers[urb_count % data->num_urbs] + urb->iso_frame_desc[k].offset;
-					memset(dest, 0, urb->iso_frame_desc[k].length);
-				}
-			}
-		} else {
-			// Handle bulk transfer (fallback for non-isochronous endpoints)
-			unsigned int samples_needed = data->urb_buffer_size / frame_size;
-			
-			// Calculate available data
-			snd_pcm_uframes_t appl_ptr = READ_ONCE(substream->runtime->control->appl_ptr);
-			snd_pcm_uframes_t appl_pos = appl_ptr % data->buffer_size;
-			
-			if (appl_pos >= data->read_ptr) {
-				available_frames = appl_pos - data->read_ptr;
-			} else {
-				available_frames = data->buffer_size - data->read_ptr + appl_pos;
-			}
-			
-			if (samples_needed > available_frames) {
-				samples_needed = available_frames;
-			}
+		if (adaptive_urbs) {
+			katana_adapt_depth(data);
 			
-			if (pcm_buffer && samples_needed > 0) {
-				unsigned int copy_size = samples_needed * frame_size;
-				copy_offset = data->read_ptr * frame_size;
-				
-				if (copy_offset + copy_size <= substream->runtime->dma_bytes) {
-					memcpy(urb->transfer_buffer, pcm_buffer + copy_offset, copy_size);
-				} else {
-					// Handle wraparound
-					unsigned int first_part = substream->runtime->dma_bytes - copy_offset;
-					unsigned int second_part = copy_size - first_part;
-					memcpy(urb->transfer_buffer, pcm_buffer + copy_offset, first_part);
-					memcpy((char*)urb->transfer_buffer + first_part, pcm_buffer, second_part);
-				}
-				
-				data->read_ptr = (data->read_ptr + samples_needed) % data->buffer_size;
-				urb->transfer_buffer_length = copy_size;
-			} else {
-				// Fill with silence
-				memset(urb->transfer_buffer, 0, data->urb_buffer_size);
-				urb->transfer_buffer_length = data->urb_buffer_size;
+			if (in_flight > data->target_urbs) {
+				// Shrinking: park this URB at its boundary, the
+				// rest carry on back to back
+				katana_retire_urb_locked(data, urb);
+				refill = 0;
+			} else if (in_flight < data->target_urbs) {
+				grow_idx = katana_claim_idle_urb_locked(data);
 			}
 		}
-		
-		// Resubmit URB
-		err = usb_submit_urb(urb, GFP_ATOMIC);
-		if (err < 0) {
-			pr_err("Katana URB resubmit failed: %d\n", err);
-		}
+	} else {
+		// Paused, or going idle on silence
+		katana_retire_urb_locked(data, urb);
 	}
+	appl_margin = katana_pending_frames(data);
 
-exit_unlock:
-	spin_unlock_irqrestore(&data->lock, flags);
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+	
+	katana_telemetry_log(KATANA_TELEMETRY_DATA, urb, idx, frames_transferred,
+			     data->urb_silence_frames[idx], feedback, appl_margin);
+	katana_tap_record(data, urb, idx);
+	
+	if (broken && xrun_on_gap) {
+		snd_pcm_stop_xrun(substream);
+		raw_spin_lock_irqsave(&data->lock, flags);
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+	} else if (period_elapsed) {
+		snd_pcm_period_elapsed(substream);
+	}
+
+	// Prepare next URB with data from PCM buffer
+	if (refill) {
+		katana_refill_urb(data, urb, idx);
+	}
+	if (grow_idx >= 0) {
+		katana_refill_urb(data, data->urbs[grow_idx], grow_idx);
+	}
+
+	katana_account_complete_time(entry);
 }
 
 // Sync URB completion handler for feedback endpoint
@@ -1097,11 +3105,17 @@ static void katana_sync_urb_complete(struct urb *urb)
 {
 	struct katana_pcm_data *data = urb->context;
 	unsigned long flags;
+	int resubmit = 0;
 	int err;
 	
+	raw_spin_lock_irqsave(&data->lock, flags);
 	if (!data->stream_started) {
-		return; // Stream was stopped
+		// Stream was stopped
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
+		return;
 	}
+	raw_spin_unlock_irqrestore(&data->lock, flags);
 	
 	switch (urb->status) {
 	case 0:
@@ -1123,24 +3137,29 @@ static void katana_sync_urb_complete(struct urb *urb)
 						 (data->sync_buffer[3] << 24));
 			}
 			
-			// Convert from 10.14 fixed-point to samples per millisecond
+			// Convert the feedback to samples per data packet
 			// The feedback value represents the number of samples the device
-			// consumed per USB frame (1ms for full-speed, 0.125ms for high-speed)
-			
-			// For full-speed USB (1ms frames):
-			// feedback_value is in 10.14 format representing samples per frame
-			unsigned int samples_per_frame = (feedback_value + 8192) >> 14;  // Round and shift
+			// consumed per USB frame (1ms for full-speed, 0.125ms for high-speed).
+			// Full speed uses 10.14 fixed point, high speed 16.16 (some
+			// devices keep sending 10.14, see KATANA_QUIRK_FB_10_14).
+			// The fill path keeps the fraction (Q16 per packet); the
+			// rounded value is only for tracking.
+			unsigned int fb_shift = (data->high_speed && !(katana_quirks & KATANA_QUIRK_FB_10_14)) ? 16 : 14;
+			u32 rate_q16 = ((u64)feedback_value << data->datainterval) << (16 - fb_shift);
+			unsigned int samples_per_frame = (rate_q16 + 0x8000) >> 16;  // Round and shift
 			
 			// Validate feedback value is reasonable for our sample rate
-			unsigned int expected_min = (data->rate * 9) / 10000;  // 90% of nominal
-			unsigned int expected_max = (data->rate * 11) / 10000; // 110% of nominal
+			u32 nominal_q16 = div_u64((u64)data->dev_rate << 16, data->packets_per_sec);
+			u32 expected_min = nominal_q16 / 10 * 9;   // 90% of nominal
+			u32 expected_max = nominal_q16 / 10 * 11;  // 110% of nominal
 			
-			if (samples_per_frame >= expected_min && samples_per_frame <= expected_max) {
-				spin_lock_irqsave(&data->lock, flags);
+			if (rate_q16 >= expected_min && rate_q16 <= expected_max) {
+				raw_spin_lock_irqsave(&data->lock, flags);
 				
 				// Update feedback tracking
 				data->feedback_value = feedback_value;
 				data->feedback_samples = samples_per_frame;
+				data->feedback_q16 = rate_q16;
 				data->feedback_count++;
 				
 				// Use simple averaging for stability
@@ -1153,12 +3172,14 @@ static void katana_sync_urb_complete(struct urb *urb)
 				
 				data->feedback_valid = 1;
 				
-				spin_unlock_irqrestore(&data->lock, flags);
+				raw_spin_unlock_irqrestore(&data->lock, flags);
 				
 				// Feedback logging removed to reduce log noise
 			} else {
 				// Invalid feedback - ignore (logging removed to reduce noise)
 			}
+			
+			katana_telemetry_log(KATANA_TELEMETRY_SYNC, urb, 0, 0, 0, feedback_value, 0);
 		}
 		break;
 		
@@ -1166,16 +3187,28 @@ static void katana_sync_urb_complete(struct urb *urb)
 	case -ECONNRESET:
 	case -ESHUTDOWN:
 		// URB was cancelled
+		raw_spin_lock_irqsave(&data->lock, flags);
+		katana_retire_urb_locked(data, urb);
+		raw_spin_unlock_irqrestore(&data->lock, flags);
 		return;
 		
 	default:
 		// Sync URB error - logging removed to reduce noise
+		katana_telemetry_log(KATANA_TELEMETRY_SYNC, urb, 0, 0, 0, 0, 0);
 		break;
 	}
 	
 	// Resubmit the sync URB to keep feedback flowing
-	if (data->stream_started && data->running) {
-		err = usb_submit_urb(urb, GFP_ATOMIC);
+	raw_spin_lock_irqsave(&data->lock, flags);
+	if (data->stream_started && data->running && !data->idle) {
+		resubmit = 1;
+	} else {
+		katana_retire_urb_locked(data, urb);
+	}
+	raw_spin_unlock_irqrestore(&data->lock, flags);
+
+	if (resubmit) {
+		err = katana_submit_claimed_urb(data, urb);
 		if (err < 0) {
 			pr_err("Katana sync URB resubmit failed: %d\n", err);
 		}
@@ -1284,7 +3317,7 @@ static int katana_alloc_urb_buffers(struct katana_pcm_data *data)
 	data->sync_urb->transfer_buffer_length = data->sync_packet_size;
 	data->sync_urb->complete = katana_sync_urb_complete;
 	data->sync_urb->context = data;
-	data->sync_urb->interval = 1;
+	data->sync_urb->interval = data->sync_interval;
 	data->sync_urb->start_frame = -1;
 	data->sync_urb->number_of_packets = 1;
 	data->sync_urb->iso_frame_desc[0].offset = 0;
@@ -1295,16 +3328,22 @@ static int katana_alloc_urb_buffers(struct katana_pcm_data *data)
 	// Sync URB allocated successfully
 	
 	// Calculate optimal packet structure for isochronous transfers
-	unsigned int packets_per_urb = 8;  // 8ms worth of packets per URB
+	unsigned int packets_per_urb = KATANA_PACKETS_PER_URB;  // 8ms worth of packets per URB
 	unsigned int frame_size = data->channels * snd_pcm_format_physical_width(data->format) / 8;
 	
-	// Calculate nominal samples per packet (1ms of audio)
-	// For 48kHz: 48 samples per packet, for 96kHz: 96 samples per packet
-	unsigned int nominal_samples_per_packet = data->rate / 1000;
+	// Calculate nominal samples per packet (1ms of audio at full speed)
+	// For 48kHz: 48 samples per packet, for 96kHz: 96 samples per packet.
+	// High speed packets are 2^datainterval microframes.
+	unsigned int nominal_samples_per_packet = data->dev_rate / data->packets_per_sec;
 	unsigned int nominal_packet_size = nominal_samples_per_packet * frame_size;
 	
+	// Packets follow the feedback, so leave room for one sample over
+	// nominal (44.1kHz needs 45 every tenth packet) where the endpoint
+	// allows it
+	unsigned int max_frames = min(nominal_samples_per_packet + 1, max_packet_size / frame_size);
+	
 	// Each URB buffer needs to hold all packets
-	unsigned int urb_buffer_size = packets_per_urb * nominal_packet_size;
+	unsigned int urb_buffer_size = packets_per_urb * max_frames * frame_size;
 	
 	// Ensure URB buffer size doesn't exceed max packet size constraints
 	if (nominal_packet_size > max_packet_size) {
@@ -1342,7 +3381,7 @@ static int katana_alloc_urb_buffers(struct katana_pcm_data *data)
 			data->urbs[i]->transfer_buffer_length = urb_buffer_size;
 			data->urbs[i]->complete = katana_urb_complete;
 			data->urbs[i]->context = data;
-			data->urbs[i]->interval = 1;  // 1ms intervals
+			data->urbs[i]->interval = 1 << data->datainterval;  // In (micro)frames
 			data->urbs[i]->start_frame = -1;  // Let USB core schedule
 			data->urbs[i]->number_of_packets = packets_per_urb;
 			data->urbs[i]->transfer_dma = data->urb_dma_addrs[i];
@@ -1373,6 +3412,7 @@ static int katana_alloc_urb_buffers(struct katana_pcm_data *data)
 	
 	// Store URB buffer size for later use
 	data->urb_buffer_size = urb_buffer_size;
+	data->packet_max_frames = max_frames;
 	
 	return 0;
 	
@@ -1411,6 +3451,11 @@ static void katana_free_urb_buffers(struct katana_pcm_data *data)
 	if (!data->urbs)
 		return;
 	
+	// Let the fill worker finish with any URB it holds; with the stream
+	// stopped it retires them instead of submitting
+	if (data->fill_worker)
+		kthread_flush_worker(data->fill_worker);
+	
 	// Stop all URBs first (including sync URB)
 	if (data->sync_urb) {
 		usb_kill_urb(data->sync_urb);
@@ -1440,6 +3485,8 @@ static void katana_free_urb_buffers(struct katana_pcm_data *data)
 	data->urbs = NULL;
 	data->urb_buffers = NULL;
 	data->urb_dma_addrs = NULL;
+	data->urbs_in_flight = 0;
+	data->stopping = 0;
 	
 	// Free sync URB resources
 	if (data->sync_buffer) {
@@ -1451,4 +3498,5 @@ static void katana_free_urb_buffers(struct katana_pcm_data *data)
 		usb_free_urb(data->sync_urb);
 		data->sync_urb = NULL;
 	}
+	data->sync_in_flight = 0;
 }
\ No newline at end of file
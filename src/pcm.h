@@ -1,8 +1,67 @@
 #pragma once
 
+#include <linux/debugfs.h>
+#include <linux/types.h>
 #include <sound/pcm.h>
 #include <sound/core.h>
 
+// Per-URB telemetry ring, mmap()ed read-only through debugfs urb_telemetry.
+// A header is followed by nr_records fixed-size records. The writer claims
+// slot (n % nr_records) for record n; a record's seq is 2n+1 while it's being
+// written and 2n+2 once complete, so readers can detect torn or overwritten
+// records without locking. head is the number of records claimed so far.
+#define KATANA_TELEMETRY_MAGIC 0x4b544c4d  // "KTLM"
+#define KATANA_TELEMETRY_VERSION 1
+#define KATANA_TELEMETRY_RECORDS 4096
+
+#define KATANA_TELEMETRY_DATA 0   // Data URB completion
+#define KATANA_TELEMETRY_SYNC 1   // Feedback URB completion
+
+struct katana_telemetry_header {
+	__u32 magic;
+	__u32 version;
+	__u32 record_size;
+	__u32 nr_records;
+	__u64 head;
+	__u8 reserved[40];
+};
+
+struct katana_telemetry_record {
+	__u64 timestamp_ns;     // ktime_get_ns() at completion
+	__u32 seq;
+	__u8 type;              // KATANA_TELEMETRY_DATA or _SYNC
+	__u8 urb;               // Slot in the data URB ring
+	__u16 reserved;
+	__s32 status;           // urb->status
+	__s32 start_frame;      // urb->start_frame
+	__u32 frames;           // PCM frames the URB carried
+	__u32 silence_frames;   // Frames padded with silence
+	__u32 feedback;         // Latest raw feedback value (10.14, 16.16 at high speed)
+	__s32 appl_margin;      // Frames queued by the application at completion
+};
+
+// Wire tap: relay channel (debugfs wire_tap<cpu>) with one record per
+// completed data URB, carrying exactly what went over the bus. Each record
+// is this header, nr_packets packet lengths, then the packets' payload
+// back to back, padded to a multiple of 8 bytes. Records are written on
+// the CPU that handled the completion; merge the per-CPU files by seq.
+#define KATANA_TAP_MAGIC 0x4b544150  // "KTAP"
+
+struct katana_tap_record {
+	__u32 magic;
+	__u32 size;             // Bytes in this record, padding included
+	__u64 timestamp_ns;     // ktime_get_ns() at completion
+	__u32 seq;              // Record number since the tap was enabled
+	__s32 status;           // urb->status
+	__s32 start_frame;      // urb->start_frame
+	__u32 feedback;         // Raw feedback value when the URB was filled
+	__u8 urb;               // Slot in the data URB ring
+	__u8 reserved;
+	__u16 nr_packets;       // Isochronous packets, 0 for bulk
+	__u32 payload_bytes;
+	__u16 packet_length[];  // Followed by the payload
+};
+
 // Operation tracking functions for disconnect synchronization
 int katana_enter_operation(void);
 void katana_exit_operation(void);
@@ -21,5 +80,14 @@ int katana_pcm_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_
 int katana_pcm_hw_free(struct snd_pcm_substream *substream);
 int katana_pcm_prepare(struct snd_pcm_substream *substream);
 int katana_pcm_trigger(struct snd_pcm_substream *substream, int cmd);
+int katana_pcm_sync_stop(struct snd_pcm_substream *substream);
 snd_pcm_uframes_t katana_pcm_pointer(struct snd_pcm_substream *substream);
-void katana_pcm_invalidate_usb_dev(struct snd_card *card);
\ No newline at end of file
+void katana_pcm_invalidate_usb_dev(struct snd_card *card);
+void katana_pcm_debugfs_init(struct dentry *root);
+void katana_pcm_telemetry_free(void);
+void katana_pcm_tap_close(void);
+struct katana_hwdep_snapshot;
+void katana_pcm_snapshot(struct katana_hwdep_snapshot *snap);
+void katana_pcm_set_trim_gain(u32 gain);
+void katana_pcm_set_quirks(unsigned long quirks);
+void katana_pcm_get_meters(u32 *peak, u32 *rms);
\ No newline at end of file
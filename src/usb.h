@@ -3,5 +3,9 @@
 #define KATANA_VENDOR_ID  0x041e
 #define KATANA_PRODUCT_ID 0x3247
 
+// Device table driver_info quirks
+#define KATANA_QUIRK_FB_10_14       (1 << 0) // High speed feedback still in 10.14 format
+#define KATANA_QUIRK_NO_RATE_RANGE  (1 << 1) // UAC2 clock doesn't answer RANGE, assume 48/96kHz
+
 #define AUDIO_CONTROL_IFACE_ID 0x0
 #define AUDIO_STREAM_IFACE_ID  0x1
\ No newline at end of file